@@ -1,6 +1,11 @@
 #include "api.h"
+#include <algorithm>
+#include <condition_variable>
 #include <curl/curl.h>
+#include <deque>
 #include <optional>
+#include <thread>
+#include <utility>
 
 using std::cerr;
 using std::optional;
@@ -12,45 +17,238 @@ size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp) {
     return total_size;
 }
 
-optional<string> curl_get(string URL) {
-    CURL* curl = curl_easy_init();
-    if (curl == nullptr) return std::nullopt;
+/*
+ * Process wide share handle: DNS cache, TLS session cache and connection
+ * pool for every HttpSession. curl calls lock/unlock around each access,
+ * one mutex per kind of shared data.
+ */
+struct CurlShare {
+    CURLSH* share = nullptr;
+    std::mutex locks[CURL_LOCK_DATA_LAST];
 
-    string response;
+    CurlShare() {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        share = curl_share_init();
+        curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lock);
+        curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlock);
+        curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    }
+    ~CurlShare() {
+        curl_share_cleanup(share);
+        curl_global_cleanup();
+    }
+
+    static void lock(CURL*, curl_lock_data data, curl_lock_access, void* user) {
+        static_cast<CurlShare*>(user)->locks[data].lock();
+    }
+    static void unlock(CURL*, curl_lock_data data, void* user) {
+        static_cast<CurlShare*>(user)->locks[data].unlock();
+    }
+
+    static CurlShare& get() {
+        static CurlShare instance;
+        return instance;
+    }
+};
 
-    curl_easy_setopt(curl, CURLOPT_URL, URL.c_str());
+HttpSession::HttpSession() {
+    CurlShare::get();
+    curl = curl_easy_init();
+}
+
+HttpSession::~HttpSession() {
+    if (curl) curl_easy_cleanup(curl);
+}
+
+HttpSession& HttpSession::shared() {
+    static HttpSession session;
+    return session;
+}
+
+// curl_easy_reset keeps live connections and caches, only options go
+optional<string> HttpSession::perform(const string& url) {
+    string response;
+    curl_easy_setopt(curl, CURLOPT_SHARE, CurlShare::get().share);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
 
-    CURLcode curl_code = curl_easy_perform(curl);
-    curl_easy_cleanup(curl);
-
-    if (curl_code != CURLE_OK) {
+    CURLcode res = curl_easy_perform(curl);
+    if (res != CURLE_OK) {
+        cerr << "curl_easy_perform() failed: " << curl_easy_strerror(res)
+             << "\n";
         return std::nullopt;
     }
+    return response;
+}
+
+optional<string> HttpSession::get(const string& url) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (curl == nullptr) return std::nullopt;
+    curl_easy_reset(curl);
+    return perform(url);
+}
 
+optional<string> HttpSession::post_json(const string& url,
+                                        const string& json_str) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (curl == nullptr) return std::nullopt;
+    curl_easy_reset(curl);
+
+    struct curl_slist* headers = nullptr;
+    headers = curl_slist_append(headers, "Content-Type: application/json");
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, json_str.c_str());
+
+    optional<string> response = perform(url);
+    curl_slist_free_all(headers);
     return response;
 }
 
-// optional<string> save_image(string image_url) {
-void save_image(string image_url) {
-    CURL* curl = curl_easy_init();
-    if (curl == nullptr) {
-        cerr << "Failed to initiate CURL\n";
+BatchFetcher::BatchFetcher(FetchOptions options) : options(options) {
+    CurlShare::get(); // curl_global_init
+    this->options.max_concurrent = std::max(1, options.max_concurrent);
+    multi = curl_multi_init();
+    curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+                      (long)this->options.max_concurrent);
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+                      (long)std::max(1, options.max_per_host));
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING,
+                      options.http2 ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING);
+
+    transfers.resize(this->options.max_concurrent);
+    for (auto& transfer : transfers) transfer.curl = curl_easy_init();
+}
+
+BatchFetcher::~BatchFetcher() {
+    for (auto& transfer : transfers) {
+        if (transfer.curl) curl_easy_cleanup(transfer.curl);
+    }
+    if (multi) curl_multi_cleanup(multi);
+}
+
+void BatchFetcher::fetch(const std::vector<string>& urls,
+                         const Callback& on_done) {
+    std::vector<Transfer*> idle;
+    for (auto& transfer : transfers) {
+        if (transfer.curl) idle.push_back(&transfer);
+    }
+    if (multi == nullptr || idle.empty()) {
+        for (size_t i = 0; i < urls.size(); i++) on_done(i, std::nullopt);
         return;
     }
 
-    string response;
-    curl_easy_setopt(curl, CURLOPT_URL, image_url.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+    // Finished transfers wait here for the worker thread, which runs
+    // on_done, so the event loop below only moves bytes
+    std::mutex mtx;
+    std::condition_variable ready;
+    std::deque<std::pair<size_t, optional<string>>> done;
+    bool loop_done = false;
+    std::thread worker([&] {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (true) {
+            ready.wait(lock, [&] { return loop_done || !done.empty(); });
+            if (done.empty()) return;
+            auto [index, body] = std::move(done.front());
+            done.pop_front();
+            lock.unlock();
+            on_done(index, std::move(body));
+            lock.lock();
+        }
+    });
+    auto hand_over = [&](size_t index, optional<string> body) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            done.emplace_back(index, std::move(body));
+        }
+        ready.notify_one();
+    };
+
+    size_t next = 0;
+    int running = 0;
+    while (next < urls.size() || running > 0) {
+        // Fill every idle slot
+        while (next < urls.size() && !idle.empty()) {
+            Transfer* transfer = idle.back();
+            idle.pop_back();
+            transfer->index = next;
+            transfer->body.clear();
+
+            CURL* curl = transfer->curl;
+            curl_easy_reset(curl);
+            curl_easy_setopt(curl, CURLOPT_URL, urls[next].c_str());
+            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &transfer->body);
+            curl_easy_setopt(curl, CURLOPT_PRIVATE, transfer);
+            curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L); // 4xx/5xx fail
+            curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+            if (options.http2) {
+                curl_easy_setopt(curl, CURLOPT_HTTP_VERSION,
+                                 (long)CURL_HTTP_VERSION_2TLS);
+                curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+            }
+            CURLMcode added = curl_multi_add_handle(multi, curl);
+            if (added != CURLM_OK) {
+                cerr << "curl_multi_add_handle failed: "
+                     << curl_multi_strerror(added) << "\n";
+                hand_over(next++, std::nullopt);
+                idle.push_back(transfer);
+                continue;
+            }
+            running++;
+            next++;
+        }
+
+        int still_running = 0;
+        curl_multi_perform(multi, &still_running);
+
+        // Hand finished transfers over and free their slots
+        CURLMsg* msg;
+        int queued;
+        while ((msg = curl_multi_info_read(multi, &queued))) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            Transfer* transfer = nullptr;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &transfer);
+            CURLcode res = msg->data.result;
+            curl_multi_remove_handle(multi, msg->easy_handle);
+            running--;
+
+            if (res == CURLE_OK) {
+                hand_over(transfer->index, std::move(transfer->body));
+            } else {
+                cerr << "curl transfer failed: " << curl_easy_strerror(res)
+                     << "\n";
+                hand_over(transfer->index, std::nullopt);
+            }
+            idle.push_back(transfer);
+        }
+
+        if (running > 0) curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        loop_done = true;
+    }
+    ready.notify_one();
+    worker.join();
+}
+
+optional<string> curl_get(string URL) {
+    return HttpSession::shared().get(URL);
+}
 
-    CURLcode res_code = curl_easy_perform(curl);
-    if (res_code != CURLE_OK) {
+// optional<string> save_image(string image_url) {
+void save_image(string image_url) {
+    optional<string> response = HttpSession::shared().get(image_url);
+    if (!response) {
         cerr << "Failed to perform GET\n";
         return;
     }
-    curl_easy_cleanup(curl);
 
     // Write to file in binary mode
     FILE* image = nullptr;
@@ -60,37 +258,15 @@ void save_image(string image_url) {
         exit(1);
     }
 
-    fwrite(response.data(), sizeof(char), response.size(), image);
-    curl_get(image_url);
+    fwrite(response->data(), sizeof(char), response->size(), image);
 
     fclose(image);
 }
 
 void api_post_data(const char* POST_URL, string json_str) {
-    CURL* curl = curl_easy_init();
-    if (!curl) return;
-
-    curl_easy_setopt(curl, CURLOPT_URL, POST_URL);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, json_str.c_str());
-
-    struct curl_slist* headers = nullptr;
-    headers = curl_slist_append(headers, "Content-Type: application/json");
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-
-    std::string response;
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-
-    CURLcode res = curl_easy_perform(curl);
-
-    curl_slist_free_all(headers);
-    curl_easy_cleanup(curl);
-
-    if (res != CURLE_OK) {
-        std::cerr << "curl_easy_perform() failed: " << curl_easy_strerror(res)
-                  << std::endl;
-        return;
-    }
+    optional<string> response =
+        HttpSession::shared().post_json(POST_URL, json_str);
+    if (!response) return;
 
-    std::cout << "Response:\n" << response << std::endl;
+    std::cout << "Response:\n" << *response << std::endl;
 }
@@ -1,15 +1,88 @@
 #ifndef GET_DATA_H
 #define GET_DATA_H
 
+#include <curl/curl.h>
+#include <functional>
 #include <iostream>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <vector>
 
 using std::cout;
 using std::endl;
 using std::optional;
 using std::string;
 
+/*
+ * HTTP client that keeps its setup between requests
+ *  - one easy handle, reset (not recreated) per request, so its open
+ *    connections are reused
+ *  - a share handle holds the DNS, TLS session and connection caches, every
+ *    HttpSession uses the same one
+ * A session runs one request at a time, calls from other threads wait.
+ */
+class HttpSession {
+public:
+    HttpSession();
+    ~HttpSession();
+    HttpSession(const HttpSession&) = delete;
+    HttpSession& operator=(const HttpSession&) = delete;
+
+    optional<string> get(const string& url);
+    optional<string> post_json(const string& url, const string& json_str);
+
+    // Session behind curl_get, save_image and api_post_data
+    static HttpSession& shared();
+
+private:
+    optional<string> perform(const string& url);
+
+    CURL* curl = nullptr;
+    std::mutex mtx;
+};
+
+// Limits for BatchFetcher
+struct FetchOptions {
+    int max_concurrent = 8; // transfers in flight
+    int max_per_host = 4;   // connections per host, HTTP/2 streams share one
+    bool http2 = true;      // negotiate HTTP/2 (TLS) and multiplex on it
+};
+
+/*
+ * Many GETs at once from one curl multi handle, driven by one event loop
+ *  - at most max_concurrent transfers run, the rest wait their turn
+ *  - easy handles are kept and reset between transfers
+ *  - with http2, transfers to the same host wait for (CURLOPT_PIPEWAIT)
+ *    and multiplex over one connection instead of opening new ones
+ * on_done(i, body) runs on one worker thread, in completion order, while
+ * the event loop keeps the other transfers moving; body is nullopt when
+ * the transfer failed. fetch() returns after the last on_done.
+ */
+class BatchFetcher {
+public:
+    using Callback =
+        std::function<void(size_t index, optional<string> body)>;
+
+    explicit BatchFetcher(FetchOptions options = {});
+    ~BatchFetcher();
+    BatchFetcher(const BatchFetcher&) = delete;
+    BatchFetcher& operator=(const BatchFetcher&) = delete;
+
+    void fetch(const std::vector<string>& urls, const Callback& on_done);
+
+private:
+    struct Transfer {
+        CURL* curl = nullptr;
+        size_t index = 0;
+        string body;
+    };
+
+    FetchOptions options;
+    CURLM* multi = nullptr;
+    std::vector<Transfer> transfers; // one per concurrent slot
+};
+
 // string get_data(const char* URL);
 optional<string> curl_get(string URL);
 void save_image(string image_url);
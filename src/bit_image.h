@@ -0,0 +1,83 @@
+#ifndef BIT_IMAGE_H
+#define BIT_IMAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Binary image, 1 bit per pixel, bit set = black
+ *  - pixel x of a row is bit (x % 64) of word (x / 64)
+ *  - every row starts on a new word, padding bits past width stay 0
+ * Scans work a word (64 pixels) at a time instead of a byte per pixel.
+ */
+struct BitImage {
+    int width = 0;
+    int height = 0;
+    int words_per_row = 0;
+    std::vector<uint64_t> words;
+
+    BitImage() = default;
+    BitImage(int width, int height) {
+        reset(width, height);
+    }
+
+    // Resize to width x height, all white, the words keep their capacity
+    void reset(int width, int height) {
+        this->width = width;
+        this->height = height;
+        this->words_per_row = (width + 63) / 64;
+        this->words.assign((size_t)words_per_row * height, 0);
+    }
+
+    uint64_t* row(int y) {
+        return &words[(size_t)y * words_per_row];
+    }
+    const uint64_t* row(int y) const {
+        return &words[(size_t)y * words_per_row];
+    }
+
+    bool is_black(int x, int y) const {
+        return (row(y)[x >> 6] >> (x & 63)) & 1;
+    }
+
+    // In-place transpose of a 64x64 bit block, a[r] bit c <-> a[c] bit r.
+    // Swaps 32x32 quadrants, then 16x16 inside those, down to single bits.
+    static void transpose64(uint64_t a[64]) {
+        uint64_t m = 0x00000000FFFFFFFFull;
+        for (int j = 32; j != 0; j >>= 1, m ^= (m << j)) {
+            for (int k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+                uint64_t t = ((a[k] >> j) ^ a[k | j]) & m;
+                a[k] ^= t << j;
+                a[k | j] ^= t;
+            }
+        }
+    }
+
+    /*
+     * Writes the image with rows and columns swapped into res (reusing its
+     * words), so column x of this image is row x of res and can be scanned
+     * contiguously.
+     *  - works on 64x64 pixel blocks: one word from each of 64 rows
+     *  - a strip of 64 rows is finished before the next, so the reads stay
+     *    in cache
+     */
+    void transpose_to(BitImage& res) const {
+        res.reset(height, width);
+        uint64_t block[64];
+        for (int by = 0; by < res.words_per_row; by++) {
+            for (int bx = 0; bx < words_per_row; bx++) {
+                for (int i = 0; i < 64; i++) {
+                    int y = by * 64 + i;
+                    block[i] = (y < height) ? row(y)[bx] : 0;
+                }
+                transpose64(block);
+                for (int j = 0; j < 64 && bx * 64 + j < width; j++) {
+                    res.row(bx * 64 + j)[by] = block[j];
+                }
+            }
+        }
+    }
+};
+
+#endif // !BIT_IMAGE_H
@@ -0,0 +1,221 @@
+#include "luma.h"
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#    define LUMA_X86
+#    include <immintrin.h>
+#endif
+
+// (sum * DIV3_MUL) >> 16 == sum / 3 for every sum of three bytes (<= 765)
+constexpr uint32_t DIV3_MUL = 21846;
+
+template <int CHANNELS>
+static void to_luma_scalar(const uint8_t* src, uint8_t* dst, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t* px = src + i * CHANNELS;
+        if constexpr (CHANNELS == 1) {
+            dst[i] = px[0];
+        } else if constexpr (CHANNELS == 2) {
+            dst[i] = (px[1] == 0) ? 255 : px[0];
+        } else {
+            uint32_t sum = px[0] + px[1] + px[2];
+            uint8_t gray = (uint8_t)((sum * DIV3_MUL) >> 16);
+            if constexpr (CHANNELS == 4) {
+                if (px[3] == 0) gray = 255;
+            }
+            dst[i] = gray;
+        }
+    }
+}
+
+#ifdef LUMA_X86
+/*
+ * SSE2 kernels
+ *  - RGB(A): each 32 bit lane holds one pixel, r+g+b is summed in the lane
+ *    and divided by 3 with a 16 bit multiply-high
+ *  - RGB is widened to RGBX in register: pixel k sits at byte 3k and is
+ *    shifted left by k bytes into lane k
+ *  - gray+alpha: each 16 bit lane holds one pixel
+ * Loops stop early enough that every 16 byte load stays inside src, the
+ * remaining pixels go through the scalar path.
+ */
+static inline __m128i sse2_rgb_to_rgbx(__m128i v) {
+    const __m128i lane0 = _mm_setr_epi32(0x00FFFFFF, 0, 0, 0);
+    const __m128i lane1 = _mm_setr_epi32(0, 0x00FFFFFF, 0, 0);
+    const __m128i lane2 = _mm_setr_epi32(0, 0, 0x00FFFFFF, 0);
+    const __m128i lane3 = _mm_setr_epi32(0, 0, 0, 0x00FFFFFF);
+    __m128i res = _mm_and_si128(v, lane0);
+    res = _mm_or_si128(res, _mm_and_si128(_mm_slli_si128(v, 1), lane1));
+    res = _mm_or_si128(res, _mm_and_si128(_mm_slli_si128(v, 2), lane2));
+    res = _mm_or_si128(res, _mm_and_si128(_mm_slli_si128(v, 3), lane3));
+    return res;
+}
+
+template <bool ALPHA>
+static inline __m128i sse2_rgbx_luma(__m128i px) {
+    const __m128i byte_mask = _mm_set1_epi32(0xFF);
+    __m128i r = _mm_and_si128(px, byte_mask);
+    __m128i g = _mm_and_si128(_mm_srli_epi32(px, 8), byte_mask);
+    __m128i b = _mm_and_si128(_mm_srli_epi32(px, 16), byte_mask);
+    __m128i sum = _mm_add_epi32(_mm_add_epi32(r, g), b);
+    __m128i gray = _mm_mulhi_epu16(sum, _mm_set1_epi32(DIV3_MUL));
+    if constexpr (ALPHA) {
+        __m128i alpha = _mm_srli_epi32(px, 24);
+        __m128i clear = _mm_cmpeq_epi32(alpha, _mm_setzero_si128());
+        gray = _mm_or_si128(gray, _mm_and_si128(clear, byte_mask));
+    }
+    return gray;
+}
+
+template <int CHANNELS>
+static size_t to_luma_sse2(const uint8_t* src, uint8_t* dst, size_t count) {
+    size_t i = 0;
+    if constexpr (CHANNELS == 2) {
+        const __m128i low_byte = _mm_set1_epi16(0xFF);
+        for (; i + 16 <= count; i += 16) {
+            __m128i out[2];
+            for (int k = 0; k < 2; k++) {
+                __m128i v = _mm_loadu_si128((const __m128i*)(src + i * 2 +
+                                                             k * 16));
+                __m128i gray = _mm_and_si128(v, low_byte);
+                __m128i alpha = _mm_srli_epi16(v, 8);
+                __m128i clear = _mm_cmpeq_epi16(alpha, _mm_setzero_si128());
+                out[k] = _mm_or_si128(gray, _mm_and_si128(clear, low_byte));
+            }
+            _mm_storeu_si128((__m128i*)(dst + i),
+                             _mm_packus_epi16(out[0], out[1]));
+        }
+    } else {
+        // the last RGB load reads 4 bytes past its 12, keep them in bounds
+        const size_t slack = (CHANNELS == 3) ? 2 : 0;
+        for (; i + 16 + slack <= count; i += 16) {
+            __m128i gray[4];
+            for (int k = 0; k < 4; k++) {
+                const uint8_t* p = src + (i + k * 4) * CHANNELS;
+                __m128i v = _mm_loadu_si128((const __m128i*)p);
+                if constexpr (CHANNELS == 3) v = sse2_rgb_to_rgbx(v);
+                gray[k] = sse2_rgbx_luma<CHANNELS == 4>(v);
+            }
+            __m128i lo = _mm_packs_epi32(gray[0], gray[1]);
+            __m128i hi = _mm_packs_epi32(gray[2], gray[3]);
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+        }
+    }
+    return i;
+}
+
+/*
+ * AVX2 kernels, same math as SSE2 on twice the pixels. Byte shifts and
+ * packs work per 128 bit lane, so each lane gets its own 4 RGB pixels and
+ * the packed result is put back in order with a cross-lane permute.
+ */
+__attribute__((target("avx2"))) static inline __m256i
+avx2_rgb_to_rgbx(__m256i v) {
+    const __m256i lane0 = _mm256_setr_epi32(0x00FFFFFF, 0, 0, 0,
+                                            0x00FFFFFF, 0, 0, 0);
+    const __m256i lane1 = _mm256_slli_si256(lane0, 4);
+    const __m256i lane2 = _mm256_slli_si256(lane0, 8);
+    const __m256i lane3 = _mm256_slli_si256(lane0, 12);
+    __m256i res = _mm256_and_si256(v, lane0);
+    res = _mm256_or_si256(res,
+                          _mm256_and_si256(_mm256_slli_si256(v, 1), lane1));
+    res = _mm256_or_si256(res,
+                          _mm256_and_si256(_mm256_slli_si256(v, 2), lane2));
+    res = _mm256_or_si256(res,
+                          _mm256_and_si256(_mm256_slli_si256(v, 3), lane3));
+    return res;
+}
+
+template <bool ALPHA>
+__attribute__((target("avx2"))) static inline __m256i
+avx2_rgbx_luma(__m256i px) {
+    const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+    __m256i r = _mm256_and_si256(px, byte_mask);
+    __m256i g = _mm256_and_si256(_mm256_srli_epi32(px, 8), byte_mask);
+    __m256i b = _mm256_and_si256(_mm256_srli_epi32(px, 16), byte_mask);
+    __m256i sum = _mm256_add_epi32(_mm256_add_epi32(r, g), b);
+    __m256i gray = _mm256_mulhi_epu16(sum, _mm256_set1_epi32(DIV3_MUL));
+    if constexpr (ALPHA) {
+        __m256i alpha = _mm256_srli_epi32(px, 24);
+        __m256i clear = _mm256_cmpeq_epi32(alpha, _mm256_setzero_si256());
+        gray = _mm256_or_si256(gray, _mm256_and_si256(clear, byte_mask));
+    }
+    return gray;
+}
+
+template <int CHANNELS>
+__attribute__((target("avx2"))) static size_t
+to_luma_avx2(const uint8_t* src, uint8_t* dst, size_t count) {
+    size_t i = 0;
+    if constexpr (CHANNELS == 2) {
+        const __m256i low_byte = _mm256_set1_epi16(0xFF);
+        for (; i + 32 <= count; i += 32) {
+            __m256i out[2];
+            for (int k = 0; k < 2; k++) {
+                __m256i v = _mm256_loadu_si256(
+                    (const __m256i*)(src + i * 2 + k * 32));
+                __m256i gray = _mm256_and_si256(v, low_byte);
+                __m256i alpha = _mm256_srli_epi16(v, 8);
+                __m256i clear =
+                    _mm256_cmpeq_epi16(alpha, _mm256_setzero_si256());
+                out[k] =
+                    _mm256_or_si256(gray, _mm256_and_si256(clear, low_byte));
+            }
+            __m256i packed = _mm256_packus_epi16(out[0], out[1]);
+            packed = _mm256_permute4x64_epi64(packed, 0xD8); // 0 2 1 3
+            _mm256_storeu_si256((__m256i*)(dst + i), packed);
+        }
+    } else {
+        const size_t slack = (CHANNELS == 3) ? 2 : 0;
+        for (; i + 32 + slack <= count; i += 32) {
+            __m256i gray[4];
+            for (int k = 0; k < 4; k++) {
+                const uint8_t* p = src + (i + k * 8) * CHANNELS;
+                __m256i v;
+                if constexpr (CHANNELS == 3) {
+                    __m128i lo = _mm_loadu_si128((const __m128i*)p);
+                    __m128i hi = _mm_loadu_si128((const __m128i*)(p + 12));
+                    v = avx2_rgb_to_rgbx(_mm256_inserti128_si256(
+                        _mm256_castsi128_si256(lo), hi, 1));
+                } else {
+                    v = _mm256_loadu_si256((const __m256i*)p);
+                }
+                gray[k] = avx2_rgbx_luma<CHANNELS == 4>(v);
+            }
+            __m256i lo = _mm256_packs_epi32(gray[0], gray[1]);
+            __m256i hi = _mm256_packs_epi32(gray[2], gray[3]);
+            __m256i packed = _mm256_packus_epi16(lo, hi);
+            const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+            packed = _mm256_permutevar8x32_epi32(packed, order);
+            _mm256_storeu_si256((__m256i*)(dst + i), packed);
+        }
+    }
+    return i;
+}
+
+static bool has_avx2() {
+    static const bool available = __builtin_cpu_supports("avx2");
+    return available;
+}
+#endif // LUMA_X86
+
+template <int CHANNELS>
+static void to_luma_impl(const uint8_t* src, uint8_t* dst, size_t count) {
+    size_t done = 0;
+#ifdef LUMA_X86
+    if (has_avx2()) done = to_luma_avx2<CHANNELS>(src, dst, count);
+    else done = to_luma_sse2<CHANNELS>(src, dst, count);
+#endif
+    to_luma_scalar<CHANNELS>(src + done * CHANNELS, dst + done, count - done);
+}
+
+void to_luma(const unsigned char* src, unsigned char* dst, size_t count,
+             int channels) {
+    switch (channels) {
+    case 1: memcpy(dst, src, count); break;
+    case 2: to_luma_impl<2>(src, dst, count); break;
+    case 3: to_luma_impl<3>(src, dst, count); break;
+    case 4: to_luma_impl<4>(src, dst, count); break;
+    }
+}
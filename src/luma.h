@@ -0,0 +1,15 @@
+#ifndef LUMA_H
+#define LUMA_H
+
+#include <cstddef>
+
+// Convert `count` interleaved pixels of `channels` (1..4) bytes each into
+// one gray byte per pixel.
+//  - gray is the truncated average (r + g + b) / 3, done in fixed point
+//  - 1 and 2 channel images are gray (+ alpha) already
+//  - a pixel with alpha == 0 (Image::is_transparent) becomes white
+// Uses AVX2 or SSE2 when the CPU has them, scalar code otherwise.
+void to_luma(const unsigned char* src, unsigned char* dst, size_t count,
+             int channels);
+
+#endif // !LUMA_H
@@ -0,0 +1,163 @@
+#include "png.h"
+#include "stb_image.h"
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+static uint32_t read_be32(const unsigned char* p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 |
+           (uint32_t)p[3];
+}
+
+static int paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    return (pb <= pc) ? b : c;
+}
+
+// Undo the per-row filters in place, 1 bit pixels filter byte by byte
+static bool unfilter(unsigned char* raw, int height, size_t stride) {
+    const unsigned char* prev = nullptr;
+    for (int y = 0; y < height; y++) {
+        unsigned char* line = raw + (size_t)y * (stride + 1);
+        unsigned char filter = line[0];
+        unsigned char* cur = line + 1;
+        for (size_t i = 0; i < stride; i++) {
+            int a = (i > 0) ? cur[i - 1] : 0;
+            int b = prev ? prev[i] : 0;
+            int c = (prev && i > 0) ? prev[i - 1] : 0;
+            switch (filter) {
+            case 0: break;
+            case 1: cur[i] += a; break;
+            case 2: cur[i] += b; break;
+            case 3: cur[i] += (a + b) / 2; break;
+            case 4: cur[i] += paeth(a, b, c); break;
+            default: return false;
+            }
+        }
+        prev = cur;
+    }
+    return true;
+}
+
+/*
+ * Chunks are walked once: IHDR must say 1 bit gray or palette, not
+ * interlaced; PLTE and tRNS decide which bit value is black; IDAT data is
+ * gathered and inflated with stb_image's zlib. Rows are then unfiltered
+ * and each byte (8 pixels, first pixel in the top bit) is mapped to 8
+ * BitImage bits with one table lookup. CRCs are not checked, same as
+ * stb_image.
+ */
+bool decode_bilevel_png(const unsigned char* data, size_t size, BitImage& out) {
+    static const unsigned char signature[8] = { 137, 80, 78, 71,
+                                                13,  10, 26, 10 };
+    if (size < 8 || memcmp(data, signature, 8) != 0) return false;
+
+    uint32_t width = 0, height = 0;
+    int color_type = -1;
+    unsigned char palette_gray[2] = { 255, 255 };
+    unsigned char palette_alpha[2] = { 255, 255 };
+    int palette_size = 0;
+    int transparent_gray = -1; // gray sample value that is transparent
+    std::vector<unsigned char> idat;
+
+    size_t pos = 8;
+    bool ended = false;
+    while (!ended && pos + 12 <= size) {
+        uint32_t len = read_be32(data + pos);
+        const unsigned char* type = data + pos + 4;
+        const unsigned char* body = data + pos + 8;
+        if (len > size - pos - 12) return false;
+        pos += 12 + (size_t)len;
+
+        if (memcmp(type, "IHDR", 4) == 0) {
+            if (len < 13) return false;
+            width = read_be32(body);
+            height = read_be32(body + 4);
+            int bit_depth = body[8];
+            color_type = body[9];
+            int interlace = body[12];
+            if (bit_depth != 1 || interlace != 0) return false;
+            if (color_type != 0 && color_type != 3) return false;
+            if (width == 0 || height == 0) return false;
+            if (width > (1u << 24) || height > (1u << 24)) return false;
+        } else if (memcmp(type, "PLTE", 4) == 0) {
+            palette_size = (int)(len / 3);
+            if (palette_size > 2) return false;
+            for (int i = 0; i < palette_size; i++) {
+                const unsigned char* rgb = body + i * 3;
+                palette_gray[i] = (unsigned char)((rgb[0] + rgb[1] + rgb[2]) /
+                                                  3);
+            }
+        } else if (memcmp(type, "tRNS", 4) == 0) {
+            if (color_type == 0 && len >= 2) {
+                transparent_gray = body[1] & 1;
+            } else if (color_type == 3) {
+                for (uint32_t i = 0; i < len && i < 2; i++) {
+                    palette_alpha[i] = body[i];
+                }
+            }
+        } else if (memcmp(type, "IDAT", 4) == 0) {
+            idat.insert(idat.end(), body, body + len);
+        } else if (memcmp(type, "IEND", 4) == 0) {
+            ended = true;
+        }
+    }
+    if (color_type < 0 || idat.empty()) return false;
+    if (color_type == 3 && palette_size == 0) return false;
+
+    // dark[v]: a pixel with bit value v is black
+    bool dark[2] = { false, false };
+    if (color_type == 0) {
+        dark[0] = transparent_gray != 0; // 0 is black unless transparent
+    } else {
+        int gray[2];
+        for (int i = 0; i < 2; i++) {
+            bool visible = i < palette_size && palette_alpha[i] != 0;
+            gray[i] = visible ? palette_gray[i] : 255;
+        }
+        dark[0] = gray[0] < gray[1];
+        dark[1] = gray[1] < gray[0];
+    }
+
+    const size_t stride = (width + 7) / 8;
+    const size_t raw_size = (size_t)height * (stride + 1);
+    if (raw_size > INT_MAX) return false;
+    int raw_len = 0;
+    char* raw = stbi_zlib_decode_malloc_guesssize(
+        (const char*)idat.data(), (int)idat.size(), (int)raw_size, &raw_len);
+    if (raw == nullptr) return false;
+    if ((size_t)raw_len < raw_size ||
+        !unfilter((unsigned char*)raw, (int)height, stride)) {
+        free(raw);
+        return false;
+    }
+
+    // byte -> 8 pixels, reversed so the first pixel lands in the low bit
+    uint8_t lut[256];
+    for (int b = 0; b < 256; b++) {
+        uint8_t bits = 0;
+        for (int i = 0; i < 8; i++) {
+            if (dark[(b >> (7 - i)) & 1]) bits |= 1 << i;
+        }
+        lut[b] = bits;
+    }
+
+    BitImage res((int)width, (int)height);
+    const int tail = (int)(width % 64);
+    for (uint32_t y = 0; y < height; y++) {
+        const unsigned char* line =
+            (const unsigned char*)raw + (size_t)y * (stride + 1) + 1;
+        uint64_t* row = res.row((int)y);
+        for (size_t i = 0; i < stride; i++) {
+            row[i / 8] |= (uint64_t)lut[line[i]] << (8 * (i % 8));
+        }
+        if (tail) row[res.words_per_row - 1] &= (1ull << tail) - 1;
+    }
+    free(raw);
+    out = std::move(res);
+    return true;
+}
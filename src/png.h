@@ -0,0 +1,14 @@
+#ifndef PNG_H
+#define PNG_H
+
+#include "bit_image.h"
+#include <cstddef>
+
+// Decode a bilevel PNG from memory straight into a BitImage.
+//  - bilevel: 1 bit grayscale, or a 1 bit palette (at most 2 entries)
+//  - the darker entry is black, transparent pixels are white
+// Returns false for any other PNG (or a broken one) and leaves out alone,
+// the caller decodes those the usual way.
+bool decode_bilevel_png(const unsigned char* data, size_t size, BitImage& out);
+
+#endif // !PNG_H
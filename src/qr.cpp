@@ -0,0 +1,1536 @@
+#include "qr.h"
+#include "luma.h"
+#include "png.h"
+#include "thread_pool.h"
+#include "nlohmann/json.hpp"
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <optional>
+#include <unordered_map>
+#ifdef __SSE2__
+#    include <immintrin.h>
+#endif
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+using namespace std;
+using json = nlohmann::ordered_json; // keys stay in pipeline order
+
+// Adds the time until it goes out of scope to ms
+struct StageTimer {
+    double& ms;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    explicit StageTimer(double& ms) : ms(ms) {}
+    ~StageTimer() {
+        auto end = chrono::steady_clock::now();
+        ms += chrono::duration<double, milli>(end - start).count();
+    }
+};
+
+string DecodeStats::to_json(int indent) const {
+    json res;
+    res["stages_ms"] = {
+        { "load", load_ms },
+        { "grayscale", grayscale_ms },
+        { "binarize", binarize_ms },
+        { "scan", scan_ms },
+        { "cluster", cluster_ms },
+        { "orientation", orientation_ms },
+        { "sampling", sampling_ms },
+        { "rs", rs_ms },
+        { "data", data_ms },
+    };
+    res["counters"] = {
+        { "rows_scanned", rows_scanned },
+        { "columns_extracted", columns_extracted },
+        { "candidate_points", candidate_points },
+        { "clusters", clusters },
+    };
+    return res.dump(indent);
+}
+
+// STAGE 2 : Structural Analysis : Pattern Matching
+struct Pattern {
+    int position;
+    float module_size;
+    int count[5]; // this is sliding window of counts that matched 1:1:3:1:1
+};
+
+/*
+ * STAGE 2a : Run-length extraction
+ * Lengths of the same-color runs of a bit-packed row or column, in order.
+ * The first run starts at pixel 0 whatever its color.
+ *  - bit i of word ^ (word << 1 | carry) is set when pixel i differs from
+ *    pixel i-1, countr_zero walks those bits
+ *  - with SSE2, 128 pixel blocks that are all the current run color are
+ *    skipped with one compare + movemask
+ * runs is cleared first, so callers can reuse one buffer.
+ */
+void get_runs(const uint64_t* bits, int len, vector<int>& runs) {
+    runs.clear();
+    if (len <= 0) return;
+
+    const int num_words = (len + 63) / 64;
+    uint64_t carry = bits[0] & 1; // no transition before pixel 0
+    int run_start = 0;
+    for (int k = 0; k < num_words; k++) {
+#ifdef __SSE2__
+        // the last word has padding bits, it always takes the scalar path
+        const __m128i fill = _mm_set1_epi8(carry ? -1 : 0);
+        while (k + 2 < num_words) {
+            __m128i v = _mm_loadu_si128((const __m128i*)&bits[k]);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, fill)) != 0xFFFF) break;
+            k += 2;
+        }
+#endif
+        uint64_t word = bits[k];
+        uint64_t diff = word ^ ((word << 1) | carry);
+        carry = word >> 63;
+        int valid = len - k * 64;
+        if (valid < 64) diff &= (1ull << valid) - 1; // drop padding bits
+        while (diff) {
+            int i = k * 64 + countr_zero(diff);
+            runs.push_back(i - run_start);
+            run_start = i;
+            diff &= diff - 1;
+        }
+    }
+    runs.push_back(len - run_start);
+}
+
+vector<Pattern> find_patterns(const vector<int>& runs) {
+    /*
+      - Takes in the runs of a single row or single col (see get_runs)
+      - Sliding window of 5 runs (at least 7 pixels)
+      - Checks if the window has 1:1:3:1:1 of b:w:b:w:b
+       - valid sliding window is created into a Pattern and added to result
+     */
+    vector<Pattern> res;
+
+    // state is the number of same color pizels appear
+    // example arr=[b b b w w b w b] => {3 2 1 1 1}
+    auto state_match = [&](const int* state) {
+        int total = 0;
+        for (int i = 0; i < 5; i++) {
+            total += state[i];
+            if (state[i] == 0) return false;
+        }
+        if (total < 7) return false;
+        float mod_size = total / 7.0f;
+
+        const float TOLERANCE = 0.75f;
+        float max_variance = mod_size * TOLERANCE;
+
+        return (abs(state[0] - mod_size * 1) < max_variance * 1 &&
+                abs(state[1] - mod_size * 1) < max_variance * 1 &&
+                abs(state[2] - mod_size * 3) < max_variance * 3 &&
+                abs(state[3] - mod_size * 1) < max_variance * 1 &&
+                abs(state[4] - mod_size * 1) < max_variance * 1);
+    };
+
+    // idx is the pixel just past the window
+    auto create_pattern_and_add_to_result = [&](const int* state, int idx) {
+        int total = 0;
+        for (int i = 0; i < 5; i++) total += state[i];
+        float mod_size = total / 7.0f;
+        int pos = idx - state[4] - state[3] - state[2] / 2;
+        Pattern pattern;
+        pattern.position = pos;
+        pattern.module_size = mod_size;
+        for (int i = 0; i < 5; i++) pattern.count[i] = state[i];
+        res.push_back(pattern);
+    };
+
+    if (runs.size() < 5) return res;
+    int end = 0;
+    for (int i = 0; i < 4; i++) end += runs[i];
+    for (size_t i = 0; i + 5 <= runs.size(); i++) {
+        const int* state = &runs[i];
+        end += state[4];
+        if (state_match(state)) create_pattern_and_add_to_result(state, end);
+    }
+
+    return res;
+}
+
+// STAGE 3 : Cluster points
+struct Point {
+    double x;
+    double y;
+};
+
+// Candidate points as struct-of-arrays, x and y in their own vectors
+struct PointList {
+    vector<double> xs;
+    vector<double> ys;
+
+    size_t size() const {
+        return xs.size();
+    }
+    void push_back(Point p) {
+        xs.push_back(p.x);
+        ys.push_back(p.y);
+    }
+    void append(const PointList& other) {
+        xs.insert(xs.end(), other.xs.begin(), other.xs.end());
+        ys.insert(ys.end(), other.ys.begin(), other.ys.end());
+    }
+};
+
+/*
+ * Greedy clustering: each point joins the first cluster (in creation
+ * order) whose centroid is closer than tolerance, or starts a new one.
+ *  - clusters are bucketed on a grid with cell size = tolerance, keyed by
+ *    the cell of their centroid
+ *  - a centroid closer than tolerance is in the point's cell or one of
+ *    the 8 around it, so only those buckets are checked
+ *  - the lowest matching index wins, same as a linear scan over all
+ *    clusters, and a cluster changes bucket when its centroid moves
+ */
+vector<Cluster> get_clusters(const PointList& points, double tolerance) {
+    const double TOLERANCE_SQR = tolerance * tolerance;
+    const double CELL = (tolerance > 0) ? tolerance : 1.0;
+    auto cell_key = [&](double x, double y, int dx = 0, int dy = 0) {
+        int64_t cx = (int64_t)floor(x / CELL) + dx;
+        int64_t cy = (int64_t)floor(y / CELL) + dy;
+        return ((uint64_t)(uint32_t)cx << 32) | (uint32_t)cy;
+    };
+
+    vector<Cluster> res;
+    unordered_map<uint64_t, vector<int>> grid;
+    for (size_t i = 0; i < points.size(); i++) {
+        double x = points.xs[i];
+        double y = points.ys[i];
+
+        int found = -1;
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                auto cell = grid.find(cell_key(x, y, dx, dy));
+                if (cell == grid.end()) continue;
+                for (int idx : cell->second) {
+                    if (found != -1 && idx > found) continue;
+                    double dist_x = x - res[idx].x;
+                    double dist_y = y - res[idx].y;
+                    double dist = dist_x * dist_x + dist_y * dist_y;
+                    if (dist < TOLERANCE_SQR) found = idx;
+                }
+            }
+        }
+
+        if (found == -1) {
+            grid[cell_key(x, y)].push_back((int)res.size());
+            res.push_back({ x, y, 1 });
+            continue;
+        }
+
+        Cluster& clst = res[found];
+        uint64_t old_key = cell_key(clst.x, clst.y);
+        clst.x = (clst.x * clst.count + x) / (clst.count + 1);
+        clst.y = (clst.y * clst.count + y) / (clst.count + 1);
+        clst.count++;
+        uint64_t new_key = cell_key(clst.x, clst.y);
+        if (new_key != old_key) {
+            vector<int>& old_cell = grid[old_key];
+            old_cell.erase(find(old_cell.begin(), old_cell.end(), found));
+            grid[new_key].push_back(found);
+        }
+    }
+    return res;
+}
+
+/*
+ * Otsu's threshold over a luma histogram
+ *  - threshold: gray <= threshold is the dark class, the middle of the
+ *    empty gap when several thresholds split the classes equally well
+ *  - separation: between-class / total variance, 1.0 = two spikes
+ *  - contrast: mean of the light class minus mean of the dark class
+ */
+struct GlobalThreshold {
+    int threshold = 0;
+    double separation = 0.0;
+    double contrast = 0.0;
+};
+
+GlobalThreshold otsu_threshold(const array<uint64_t, 256>& hist) {
+    double total = 0, sum_all = 0, sqr_all = 0;
+    for (int i = 0; i < 256; i++) {
+        total += hist[i];
+        sum_all += (double)i * hist[i];
+        sqr_all += (double)i * i * hist[i];
+    }
+    GlobalThreshold res;
+    if (total == 0) return res;
+
+    double best = -1.0;
+    int best_last = 0; // last threshold that ties with best
+    double count_dark = 0, sum_dark = 0;
+    for (int t = 0; t < 255; t++) {
+        count_dark += hist[t];
+        sum_dark += (double)t * hist[t];
+        double count_light = total - count_dark;
+        if (count_dark == 0 || count_light == 0) continue;
+        double mean_dark = sum_dark / count_dark;
+        double mean_light = (sum_all - sum_dark) / count_light;
+        double diff = mean_light - mean_dark;
+        double between = count_dark * count_light * diff * diff;
+        if (between > best) {
+            best = between;
+            res.threshold = t;
+            res.contrast = diff;
+        }
+        if (between == best) best_last = t;
+    }
+    res.threshold = (res.threshold + best_last) / 2;
+
+    double mean = sum_all / total;
+    double variance = sqr_all / total - mean * mean;
+    if (best > 0 && variance > 0) {
+        res.separation = best / (total * total) / variance;
+    }
+    return res;
+}
+
+// Gray levels between the darkest and lightest `trim`+1 pixels, so a few
+// noisy pixels do not count as contrast
+int histogram_spread(const array<uint64_t, 256>& hist, uint64_t trim) {
+    int lo = 0, hi = 255;
+    for (uint64_t seen = 0; lo < 255; lo++) {
+        seen += hist[lo];
+        if (seen > trim) break;
+    }
+    for (uint64_t seen = 0; hi > 0; hi--) {
+        seen += hist[hi];
+        if (seen > trim) break;
+    }
+    return max(0, hi - lo);
+}
+
+// Frees an stb_image buffer
+struct StbFree {
+    void operator()(unsigned char* p) const {
+        stbi_image_free(p);
+    }
+};
+using StbPixels = unique_ptr<unsigned char, StbFree>;
+
+// STAGE 4, defined after Image
+QROrientation determine_orientation(vector<Cluster>& clusters);
+
+/*
+ * Move-only: grayscale may point into grayscale_buf or pixels, a copy
+ * would share (and outlive) them. Moving keeps both valid.
+ * pixels is only read. pixels_buf owns it when the Image decoded it,
+ * otherwise the caller's memory is used in place and must outlive the
+ * Image.
+ */
+struct Image {
+    int width;
+    int height;
+    int channels;
+    PixelFormat format; // channels says all the pipeline needs about it
+    const unsigned char* pixels;
+    size_t row_stride; // bytes from one row of pixels to the next
+    StbPixels pixels_buf;
+    Options options;
+
+    // Built after PREPROCESSING
+    // grayscale stays nullptr with Binarizer::STREAMING
+    // 1 channel images use pixels as grayscale, nothing is copied
+    const unsigned char* grayscale = nullptr;
+    size_t gray_stride = 0; // row_stride then, width otherwise
+    vector<unsigned char> grayscale_buf; // holds grayscale otherwise
+    BitImage binary;
+    BitImage binary_t; // binary transposed, columns as rows
+
+    // Luma histogram, collected while building grayscale
+    array<uint64_t, 256> histogram = {};
+    // binary came from one global threshold, not the adaptive one
+    bool global_binary = false;
+    // Nothing that could hold a symbol, binary is never built
+    bool blank = false;
+
+    // Vertical patterns of each column, filled the first time a
+    // horizontal hit lands on that column (see column_patterns())
+    vector<optional<vector<Pattern>>> column_cache;
+    shared_ptr<once_flag[]> column_once;
+
+    // Rows are processed in bands of BAND_ROWS on the pool. Band edges
+    // do not depend on the thread count, neither do the results.
+    static constexpr int BAND_ROWS = 64;
+    shared_ptr<ThreadPool> pool;
+    // Shared with the coarse level and finder windows, see DecodeStats
+    shared_ptr<DecodeStats> stats;
+
+    // Detection runs on a 1/2^pyramid_level downscale first, full
+    // resolution preprocessing is deferred until it is needed
+    int pyramid_level = 0;
+    bool preprocessed = false;
+    // The image should hold all three finders, false for the windows
+    // around a single finder in refine_cluster
+    bool whole_symbol = true;
+
+    // Constructor over the pixels of view, read in place whatever their
+    // stride. pool is shared with the caller if given and the buffers in
+    // scratch are reused (see release_scratch)
+    Image(const ImageView& view, Options options = {},
+          shared_ptr<ThreadPool> pool = nullptr,
+          shared_ptr<DecodeStats> stats = nullptr, Scratch scratch = {}) {
+        this->width = view.width;
+        this->height = view.height;
+        this->channels = view.channels();
+        this->format = view.format;
+        this->pixels = view.pixels;
+        this->row_stride = view.row_stride();
+        this->options = options;
+        this->pool = pool ? pool : make_shared<ThreadPool>(options.threads);
+        this->stats = stats ? stats : make_shared<DecodeStats>();
+        this->grayscale_buf = move(scratch.gray);
+        this->binary = move(scratch.binary);
+        this->binary_t = move(scratch.binary_t);
+
+        this->pyramid_level = pick_pyramid_level();
+        if (pyramid_level == 0) do_preprocessing();
+    }
+    // Bilevel input (see png.h), binary is given so there is no
+    // PREPROCESSING and no pyramid
+    Image(BitImage binary, Options options = {},
+          shared_ptr<ThreadPool> pool = nullptr,
+          shared_ptr<DecodeStats> stats = nullptr, Scratch scratch = {}) {
+        this->width = binary.width;
+        this->height = binary.height;
+        this->channels = 0;
+        this->format = PixelFormat::GRAY;
+        this->pixels = nullptr;
+        this->row_stride = 0;
+        this->options = options;
+        this->pool = pool ? pool : make_shared<ThreadPool>(options.threads);
+        this->stats = stats ? stats : make_shared<DecodeStats>();
+        this->grayscale_buf = move(scratch.gray);
+        this->binary_t = move(scratch.binary_t);
+
+        StageTimer timer(this->stats->binarize_ms);
+        this->binary = move(binary);
+        this->blank = all_of(this->binary.words.begin(),
+                             this->binary.words.end(),
+                             [](uint64_t word) { return word == 0; });
+        if (!blank) binary_ready();
+        this->preprocessed = true;
+    }
+    // Takes over a decoded stb_image buffer, gray or gray + alpha
+    Image(int width, int height, int channels, StbPixels pixels,
+          Options options = {}, shared_ptr<ThreadPool> pool = nullptr,
+          shared_ptr<DecodeStats> stats = nullptr, Scratch scratch = {})
+        : Image(ImageView{ pixels.get(), width, height,
+                           (channels == 2) ? PixelFormat::GRAY_ALPHA
+                                           : PixelFormat::GRAY },
+                options, pool, stats, move(scratch)) {
+        this->pixels_buf = move(pixels);
+    }
+
+    Image(const Image&) = delete;
+    Image& operator=(const Image&) = delete;
+    Image(Image&&) = default;
+    Image& operator=(Image&&) = default;
+
+public:
+    const unsigned char* pixel_row(int y) const {
+        return pixels + (size_t)y * row_stride;
+    }
+    const unsigned char* grayscale_row(int y) const {
+        return grayscale + (size_t)y * gray_stride;
+    }
+    ImageView view() const {
+        return { pixels, width, height, format, row_stride };
+    }
+
+    // Luma of rows [h0, h1) into dst, packed, one to_luma call when the
+    // rows are packed too
+    void to_luma_rows(int h0, int h1, unsigned char* dst) const {
+        if (row_stride == (size_t)width * channels) {
+            to_luma(pixel_row(h0), dst, (size_t)(h1 - h0) * width, channels);
+            return;
+        }
+        for (int h = h0; h < h1; h++) {
+            to_luma(pixel_row(h), dst + (size_t)(h - h0) * width, width,
+                    channels);
+        }
+    }
+
+    // Hands the buffers back for the next Image, this one is done
+    Scratch release_scratch() {
+        this->grayscale = nullptr;
+        return { move(grayscale_buf), move(binary), move(binary_t) };
+    }
+
+    // Pixel (x, y) of the source, through the row stride
+    const unsigned char* pixel(int x, int y) const {
+        return pixel_row(y) + (size_t)x * channels;
+    }
+
+    array<int, 3> rgb(int x, int y) const {
+        const unsigned char* px = pixel(x, y);
+        if (channels < 3) return { px[0], px[0], px[0] };
+        if (format == PixelFormat::BGR || format == PixelFormat::BGRA) {
+            return { px[2], px[1], px[0] };
+        }
+        return { px[0], px[1], px[2] };
+    }
+
+    // Alpha is the last channel of GRAY_ALPHA and RGBA / BGRA
+    bool is_transparent(int x, int y) const {
+        if (channels != 2 && channels != 4) return false;
+        return pixel(x, y)[channels - 1] == 0;
+    }
+
+    bool is_black(int x, int y) const {
+        if (is_transparent(x, y)) return false;
+        auto [r, g, b] = rgb(x, y);
+        return (r == 0 && g == 0 && b == 0);
+    };
+
+    bool is_white(int x, int y) const {
+        if (is_transparent(x, y)) return false;
+        auto [r, g, b] = rgb(x, y);
+        return (r == 255 && g == 255 && b == 255);
+    };
+
+    /*
+     * STAGE 1 : PREPROCESSING
+     * Build grayscale, using average intensity of rgb (see luma.h), a 1
+     * channel image (gray, or the Y plane of NV12 / I420) already is
+     * grayscale and is used in place
+     * Build binary image (see BitImage) using adaptive thresholding
+     *  - a pixel is black when it is darker than the mean of the
+     *    WINDOW_SIZE x WINDOW_SIZE window around it minus THRESHOLD_BIAS
+     *  - options.binarizer picks how that window mean is computed
+     *  - with options.global_threshold, clearly bimodal images (clean
+     *    renders) use one Otsu threshold instead, detect_patterns falls
+     *    back to the adaptive one if that finds no symbol
+     *  - Binarizer::STREAMING never builds the histogram, so it is always
+     *    adaptive and never rejected as blank
+     * Blank or uniform images (see is_blank) stop after grayscale
+     * Build binary_t once, for the vertical checks in detect_patterns
+     * Every step runs on row bands in parallel, a band's threshold window
+     * reads up to WINDOW_SIZE / 2 rows past its edges (the halo)
+     * grayscale_buf holds grayscale, binary and binary_t are refilled in
+     * place, so buffers from a Scratch keep their capacity
+     */
+    static constexpr int WINDOW_SIZE = 15;
+    static constexpr int THRESHOLD_BIAS = 10;
+    // Otsu result needed to skip the adaptive threshold
+    static constexpr double BIMODAL_MIN_SEPARATION = 0.9;
+    static constexpr double BIMODAL_MIN_CONTRAST = 96.0;
+
+    void do_preprocessing() {
+        // Fused mode thresholds while converting, no full-frame grayscale
+        if (options.binarizer == Binarizer::STREAMING) {
+            binarize_adaptive();
+            this->preprocessed = true;
+            return;
+        }
+
+        build_grayscale();
+
+        // Nothing to detect, skip the binary image
+        if (is_blank()) {
+            this->blank = true;
+            this->preprocessed = true;
+            return;
+        }
+
+        // Build binary image
+        GlobalThreshold global = otsu_threshold(histogram);
+        if (options.global_threshold &&
+            global.separation >= BIMODAL_MIN_SEPARATION &&
+            global.contrast >= BIMODAL_MIN_CONTRAST) {
+            binarize_global(global.threshold);
+        } else {
+            binarize_adaptive();
+        }
+        this->preprocessed = true;
+    }
+
+    // Grayscale and its histogram, one per band then merged
+    void build_grayscale() {
+        StageTimer timer(stats->grayscale_ms);
+        if (channels == 1) {
+            this->grayscale = pixels;
+            this->gray_stride = row_stride;
+        } else {
+            this->grayscale_buf.resize((size_t)height * width);
+            this->grayscale = grayscale_buf.data();
+            this->gray_stride = width;
+        }
+        int num_bands = (height + BAND_ROWS - 1) / BAND_ROWS;
+        vector<array<uint64_t, 256>> band_hist(num_bands);
+        for_each_band([&](int h0, int h1) {
+            if (grayscale != pixels) {
+                to_luma_rows(h0, h1, &grayscale_buf[(size_t)h0 * width]);
+            }
+            auto& hist = band_hist[h0 / BAND_ROWS];
+            hist.fill(0);
+            for (int h = h0; h < h1; h++) {
+                const unsigned char* gray_row = grayscale_row(h);
+                for (int w = 0; w < width; w++) hist[gray_row[w]]++;
+            }
+        });
+        histogram.fill(0);
+        for (int b = 0; b < num_bands; b++) {
+            for (int i = 0; i < 256; i++) histogram[i] += band_hist[b][i];
+        }
+    }
+
+    /*
+     * Blank or uniform image, no symbol can be in it: the trimmed luma
+     * range is under BLANK_MIN_SPREAD levels
+     *  - BLANK_SPREAD_TRIM pixels are dropped at each end, so noise and
+     *    dust do not count but a small symbol on a large page does
+     *  - only the range is used: sharpness says nothing about whether a
+     *    blurred symbol can still be read, variance is barely moved by a
+     *    small symbol on a white page
+     */
+    static constexpr int BLANK_MIN_SPREAD = 32;
+    static constexpr uint64_t BLANK_SPREAD_TRIM = 16;
+
+    bool is_blank() {
+        return histogram_spread(histogram, BLANK_SPREAD_TRIM) <
+               BLANK_MIN_SPREAD;
+    }
+
+    // Adaptive threshold with options.binarizer, replaces binary
+    void binarize_adaptive() {
+        StageTimer timer(stats->binarize_ms);
+        binary.reset(width, height);
+        for_each_band([&](int h0, int h1) {
+            switch (options.binarizer) {
+            case Binarizer::WINDOW: binarize_window(h0, h1); break;
+            case Binarizer::INTEGRAL: binarize_integral(h0, h1); break;
+            case Binarizer::STREAMING: binarize_streaming(h0, h1); break;
+            }
+        });
+        this->global_binary = false;
+        binary_ready();
+    }
+
+    // gray <= threshold is black, replaces binary
+    void binarize_global(int threshold) {
+        StageTimer timer(stats->binarize_ms);
+        binary.reset(width, height);
+        for_each_band([&](int h0, int h1) {
+            for (int h = h0; h < h1; h++) {
+                const unsigned char* gray_row = grayscale_row(h);
+                uint64_t* out = binary.row(h);
+                for (int w = 0; w < width; w++) {
+                    uint64_t dark = gray_row[w] <= threshold;
+                    out[w >> 6] |= dark << (w & 63);
+                }
+            }
+        });
+        this->global_binary = true;
+        binary_ready();
+    }
+
+    // Rebuild what depends on binary
+    void binary_ready() {
+        binary.transpose_to(binary_t);
+        this->column_cache.assign(width, nullopt);
+        this->column_once.reset(new once_flag[width]);
+    }
+
+    // fn(h0, h1) for every band of rows [h0, h1), in parallel
+    void for_each_band(const function<void(int, int)>& fn) {
+        int num_bands = (height + BAND_ROWS - 1) / BAND_ROWS;
+        pool->parallel_for(num_bands, [&](int band) {
+            fn(band * BAND_ROWS, min(height, (band + 1) * BAND_ROWS));
+        });
+    }
+
+    // gray < sum/count - BIAS, without the division
+    static bool is_dark(uint32_t gray, uint32_t sum, uint32_t count) {
+        return (gray + THRESHOLD_BIAS) * count < sum;
+    }
+
+    void binarize_window(int h0, int h1) {
+        auto get_threshold = [&](int h, int w) {
+            double total = 0.0;
+            int count = 0; // valid cells
+            int half_win = WINDOW_SIZE / 2;
+            for (int curr_h = h - half_win; curr_h <= h + half_win; curr_h++) {
+                if (curr_h < 0 || curr_h >= height) continue;
+                for (int curr_w = w - half_win; curr_w <= w + half_win;
+                     curr_w++) {
+                    if (curr_w < 0 || curr_w >= width) continue;
+                    total += grayscale_row(curr_h)[curr_w];
+                    count++;
+                }
+            }
+            double avg = total / count;
+            return (double)(avg - THRESHOLD_BIAS);
+        };
+        for (int h = h0; h < h1; h++) {
+            const unsigned char* gray_row = grayscale_row(h);
+            uint64_t* out = binary.row(h);
+            for (int w = 0; w < width; w++) {
+                double threshold = get_threshold(h, w);
+                uint64_t dark = gray_row[w] < threshold;
+                out[w >> 6] |= dark << (w & 63);
+            }
+        }
+    }
+
+    /*
+     * Same threshold as binarize_window(), but the window sum comes from a
+     * summed-area table, so each pixel costs 4 loads instead of 225.
+     *  - sat covers rows [y_lo, y_hi): the band plus its halo
+     *  - sat is (y_hi-y_lo+1) x (width+1), row 0 and column 0 are zero
+     *  - the window is clipped to the image, count is the clipped area
+     *  - uint32_t may wrap on huge frames, a window sum never does, so the
+     *    modular difference is still exact
+     * Away from the borders this matches binarize_window() bit for bit.
+     */
+    void binarize_integral(int h0, int h1) {
+        const int half_win = WINDOW_SIZE / 2;
+        const int y_lo = max(0, h0 - half_win);
+        const int y_hi = min(height, h1 + half_win);
+        const size_t stride = (size_t)width + 1;
+        vector<uint32_t> sat(stride * (y_hi - y_lo + 1), 0);
+        for (int h = y_lo; h < y_hi; h++) {
+            const unsigned char* gray_row = grayscale_row(h);
+            const uint32_t* above = &sat[(size_t)(h - y_lo) * stride];
+            uint32_t* curr = &sat[(size_t)(h - y_lo + 1) * stride];
+            uint32_t row_sum = 0;
+            for (int w = 0; w < width; w++) {
+                row_sum += gray_row[w];
+                curr[w + 1] = above[w + 1] + row_sum;
+            }
+        }
+
+        for (int h = h0; h < h1; h++) {
+            int y0 = max(0, h - half_win);
+            int y1 = min(height, h + half_win + 1);
+            const uint32_t* top = &sat[(size_t)(y0 - y_lo) * stride];
+            const uint32_t* bottom = &sat[(size_t)(y1 - y_lo) * stride];
+            const unsigned char* gray_row = grayscale_row(h);
+            uint64_t* out = binary.row(h);
+            for (int w = 0; w < width; w++) {
+                int x0 = max(0, w - half_win);
+                int x1 = min(width, w + half_win + 1);
+                uint32_t count = (uint32_t)((y1 - y0) * (x1 - x0));
+                uint32_t sum = bottom[x1] - bottom[x0] - top[x1] + top[x0];
+                uint64_t dark = is_dark(gray_row[w], sum, count);
+                out[w >> 6] |= dark << (w & 63);
+            }
+        }
+    }
+
+    /*
+     * Fused grayscale + threshold in a single pass over the source pixels.
+     *  - ring keeps the WINDOW_SIZE luma rows around row h, row r lives in
+     *    slot r % WINDOW_SIZE
+     *  - col_sum[w] is the sum of column w over those rows, updated as one
+     *    row enters and one leaves
+     *  - a running sum over col_sum gives the window sum along the row
+     * Each output row is written as soon as its window is complete. A band
+     * first loads the halo rows above h0. Output matches
+     * binarize_integral().
+     */
+    void binarize_streaming(int h0, int h1) {
+        const int half_win = WINDOW_SIZE / 2;
+        vector<unsigned char> ring((size_t)WINDOW_SIZE * width);
+        vector<uint32_t> col_sum(width, 0);
+        auto ring_row = [&](int r) {
+            return &ring[(size_t)(r % WINDOW_SIZE) * width];
+        };
+        auto add_row = [&](int r) {
+            unsigned char* row = ring_row(r);
+            to_luma(pixel_row(r), row, width, channels);
+            for (int w = 0; w < width; w++) col_sum[w] += row[w];
+        };
+
+        const int first_row = max(0, h0 - half_win);
+        for (int r = first_row; r < min(height, h0 + half_win); r++) {
+            add_row(r);
+        }
+        for (int h = h0; h < h1; h++) {
+            // leaving row shares its ring slot with the entering row
+            int leaving = h - half_win - 1;
+            if (leaving >= first_row) {
+                const unsigned char* row = ring_row(leaving);
+                for (int w = 0; w < width; w++) col_sum[w] -= row[w];
+            }
+            if (h + half_win < height) add_row(h + half_win);
+
+            uint32_t rows =
+                min(height, h + half_win + 1) - max(0, h - half_win);
+            const unsigned char* gray_row = ring_row(h);
+            uint64_t* out = binary.row(h);
+            uint32_t sum = 0;
+            for (int w = 0; w < min(width, half_win); w++) sum += col_sum[w];
+            for (int w = 0; w < width; w++) {
+                if (w + half_win < width) sum += col_sum[w + half_win];
+                if (w - half_win - 1 >= 0) sum -= col_sum[w - half_win - 1];
+                uint32_t cols = min(width, w + half_win + 1) -
+                                max(0, w - half_win);
+                uint64_t dark = is_dark(gray_row[w], sum, rows * cols);
+                out[w >> 6] |= dark << (w & 63);
+            }
+        }
+    }
+
+    // Vertical patterns of column x, sorted by position. Each column is
+    // scanned at most once per image, however many rows (or threads) hit
+    // it.
+    const vector<Pattern>& column_patterns(int x, vector<int>& runs) {
+        optional<vector<Pattern>>& cached = column_cache[x];
+        call_once(column_once[x], [&] {
+            get_runs(binary_t.row(x), height, runs);
+            cached = find_patterns(runs);
+            atomic_ref<uint64_t>(stats->columns_extracted)
+                .fetch_add(1, memory_order_relaxed);
+        });
+        return *cached;
+    }
+
+    /*
+     * Scan row r for 1:1:3:1:1 patterns and verify each one vertically
+     *  - a hit at center_x is verified when column center_x has a pattern
+     *    within 1.5 modules of r
+     *  - verified centers are appended to out, returns how many
+     */
+    int scan_row(int r, vector<int>& runs, PointList& out) {
+        int found = 0;
+
+        // find horizontal patterns in the row
+        get_runs(binary.row(r), width, runs);
+        vector<Pattern> h_patterns = find_patterns(runs);
+
+        // for each horizontal pattern, verify vertically
+        for (auto& h_pattern : h_patterns) {
+            int center_x = h_pattern.position;
+            float mod_size = h_pattern.module_size;
+
+            // The column at this x position
+            auto& v_patterns = column_patterns(center_x, runs);
+
+            // Use larger tolerance for large images
+            float tolerance = mod_size * 1.5f; // ??????????
+
+            // Check if any vertical pattern is neare our current y:
+            // binary search for the first one above r - tolerance
+            auto too_high = [&](const Pattern& p) {
+                return p.position <= r - tolerance;
+            };
+            auto v_pattern = partition_point(v_patterns.begin(),
+                                             v_patterns.end(), too_high);
+            if (v_pattern != v_patterns.end()) {
+                int center_y = v_pattern->position;
+                if (abs(center_y - r) < tolerance) {
+                    // verified, add this point
+                    out.push_back({ (double)center_x, (double)center_y });
+                    found++;
+                }
+            }
+        }
+        return found;
+    }
+
+    // options.module_size, or else the smallest plausible module: a
+    // version 40 symbol (177 modules + 8 quiet zone) filling the shorter
+    // side. At least 1 pixel.
+    float expected_module_size() {
+        return expected_module_size(width, height, options);
+    }
+    static float expected_module_size(int width, int height,
+                                      const Options& options) {
+        if (options.module_size > 0) return options.module_size;
+        return max(1.0f, min(width, height) / 185.0f);
+    }
+
+    /*
+     * Rows between probes in ScanMode::ADAPTIVE
+     *  - the finder's center stone is 3 modules tall, stepping by half of
+     *    that still lands at least one probe inside it
+     */
+    int adaptive_row_step() {
+        return max(1, (int)(expected_module_size() * 1.5f));
+    }
+
+    /*
+     * Scan the given rows in parallel, chunks of BAND_ROWS rows per task
+     *  - row_points[r] gets the points of row r, found[r] their count
+     *  - every task has its own runs buffer
+     */
+    void scan_rows(const vector<int>& rows, vector<PointList>& row_points,
+                   vector<int>& found) {
+        StageTimer timer(stats->scan_ms);
+        stats->rows_scanned += rows.size();
+        int num_chunks = ((int)rows.size() + BAND_ROWS - 1) / BAND_ROWS;
+        pool->parallel_for(num_chunks, [&](int chunk) {
+            vector<int> runs;
+            int end = min((int)rows.size(), (chunk + 1) * BAND_ROWS);
+            for (int i = chunk * BAND_ROWS; i < end; i++) {
+                int r = rows[i];
+                found[r] = scan_row(r, runs, row_points[r]);
+            }
+        });
+    }
+
+    /*
+     * Probe every step-th row, and around each row that has a hit scan
+     * every row within step of it. Hits in those rows widen the dense
+     * band further, so the whole center stone gets covered and the finder
+     * center stays unbiased.
+     *  - runs in waves: probes first, then the unscanned neighbours of
+     *    every row that hit in the last wave, until nothing is left
+     *  - the set of rows scanned is the same in any order, and points come
+     *    out in row order like a full scan, so any thread count gives the
+     *    same result
+     */
+    PointList scan_rows_adaptive() {
+        const int step = adaptive_row_step();
+        vector<PointList> row_points(height);
+        vector<int> found(height, 0);
+        vector<bool> scanned(height, false);
+
+        vector<int> wave;
+        for (int probe = 0; probe < height; probe += step) {
+            wave.push_back(probe);
+            scanned[probe] = true;
+        }
+        while (!wave.empty()) {
+            scan_rows(wave, row_points, found);
+
+            vector<int> next;
+            for (int r : wave) {
+                if (found[r] == 0) continue;
+                int lo = max(0, r - step + 1);
+                int hi = min(height - 1, r + step - 1);
+                for (int rr = lo; rr <= hi; rr++) {
+                    if (scanned[rr]) continue;
+                    scanned[rr] = true;
+                    next.push_back(rr);
+                }
+            }
+            sort(next.begin(), next.end());
+            wave = std::move(next);
+        }
+
+        PointList res;
+        for (auto& points : row_points) res.append(points);
+        return res;
+    }
+
+    /*
+     * STAGE 1b : PYRAMID, for very large inputs
+     * Level used for detection: 0 (full resolution) for images under
+     * PYRAMID_MIN_PIXELS, otherwise the deepest level (at most 2, a 4x
+     * downscale) that keeps the expected module at least
+     * PYRAMID_MIN_MODULE pixels wide.
+     * The same rule picks the scaled JPEG decode (see load_image).
+     * A forced level is clamped too: the coarse image keeps at least
+     * PYRAMID_MIN_SIDE pixels a side, room for one finder.
+     */
+    static constexpr size_t PYRAMID_MIN_PIXELS = 4'000'000;
+    static constexpr float PYRAMID_MIN_MODULE = 3.0f;
+    static constexpr int PYRAMID_MIN_SIDE = 7;
+
+    int pick_pyramid_level() {
+        int level = options.pyramid_level >= 0
+                        ? min(options.pyramid_level, 2)
+                        : scale_level(width, height, options, 2);
+        while (level > 0 && min(width, height) >> level < PYRAMID_MIN_SIDE) {
+            level--;
+        }
+        return level;
+    }
+    static int scale_level(int width, int height, const Options& options,
+                           int max_level) {
+        if ((size_t)width * height < PYRAMID_MIN_PIXELS) return 0;
+        int level = 0;
+        float module = expected_module_size(width, height, options);
+        while (level < max_level && module / 2 >= PYRAMID_MIN_MODULE) {
+            module /= 2;
+            level++;
+        }
+        return level;
+    }
+
+    // Box-filtered luma at 1/2^level scale, converted from the source one
+    // band of rows at a time. Leftover edge pixels are dropped.
+    vector<unsigned char> downscale(int level, int& out_w, int& out_h) {
+        StageTimer timer(stats->grayscale_ms);
+        const int f = 1 << level;
+        out_w = width >> level;
+        out_h = height >> level;
+        vector<unsigned char> res((size_t)out_w * out_h);
+        int num_bands = (out_h + BAND_ROWS - 1) / BAND_ROWS;
+        pool->parallel_for(num_bands, [&](int band) {
+            vector<unsigned char> luma((size_t)f * width);
+            vector<uint32_t> sums(out_w);
+            int y_end = min(out_h, (band + 1) * BAND_ROWS);
+            for (int y = band * BAND_ROWS; y < y_end; y++) {
+                to_luma_rows(y * f, (y + 1) * f, luma.data());
+                fill(sums.begin(), sums.end(), 0);
+                for (int dy = 0; dy < f; dy++) {
+                    const unsigned char* src = &luma[(size_t)dy * width];
+                    for (int x = 0; x < out_w * f; x++) {
+                        sums[x >> level] += src[x];
+                    }
+                }
+                unsigned char* dst = &res[(size_t)y * out_w];
+                for (int x = 0; x < out_w; x++) {
+                    dst[x] = (unsigned char)(sums[x] >> (2 * level));
+                }
+            }
+        });
+        return res;
+    }
+
+    /*
+     * Finder center near (x, y) at full resolution
+     *  - crops a window of half size radius from the source and runs the
+     *    whole pipeline on it
+     *  - keeps the found cluster closest to (x, y), or (x, y) itself if
+     *    the window has none
+     */
+    Cluster refine_cluster(const Cluster& coarse, int radius) {
+        int x0 = max(0, (int)coarse.x - radius);
+        int y0 = max(0, (int)coarse.y - radius);
+        int x1 = min(width, (int)coarse.x + radius + 1);
+        int y1 = min(height, (int)coarse.y + radius + 1);
+        if (x1 <= x0 || y1 <= y0) return coarse;
+
+        Options roi_options = options;
+        roi_options.pyramid_level = 0;
+        Image roi(view().sub(x0, y0, x1 - x0, y1 - y0), roi_options, pool,
+                  stats);
+        roi.whole_symbol = false;
+
+        Cluster res = coarse;
+        double best = numeric_limits<double>::max();
+        for (auto& c : roi.detect_patterns()) {
+            double dx = c.x + x0 - coarse.x;
+            double dy = c.y + y0 - coarse.y;
+            if (dx * dx + dy * dy >= best) continue;
+            best = dx * dx + dy * dy;
+            res.x = c.x + x0;
+            res.y = c.y + y0;
+        }
+        return res;
+    }
+
+    /*
+     * Coarse-to-fine detection: run the pipeline on the downscaled image,
+     * then refine the three clusters in full resolution windows. Empty
+     * when the coarse level does not find three clusters.
+     */
+    vector<Cluster> detect_patterns_pyramid(int level) {
+        int coarse_w, coarse_h;
+        vector<unsigned char> coarse_gray =
+            downscale(level, coarse_w, coarse_h);
+        Options coarse_options = options;
+        coarse_options.pyramid_level = 0;
+        if (options.module_size > 0) {
+            coarse_options.module_size = options.module_size / (1 << level);
+        }
+        Image coarse(ImageView{ coarse_gray.data(), coarse_w, coarse_h },
+                     coarse_options, pool, stats);
+        vector<Cluster> clusters = coarse.detect_patterns();
+        // a uniform downscale is a uniform image, full resolution is not
+        // worth preprocessing (detect_patterns returns on blank)
+        if (coarse.blank) this->blank = true;
+        if (clusters.size() < 3) return {};
+
+        // coarse pixel i covers full resolution pixels [i*f, (i+1)*f)
+        const double f = 1 << level;
+        int radius = (int)(max(width, height) * 0.05) + WINDOW_SIZE;
+        for (auto& c : clusters) {
+            c.x = (c.x + 0.5) * f - 0.5;
+            c.y = (c.y + 0.5) * f - 0.5;
+            c = refine_cluster(c, radius);
+        }
+        return clusters;
+    }
+
+    // Main finder pattern detection
+    vector<Cluster> detect_patterns() {
+        // step 0 : coarse-to-fine on large images, full resolution if that
+        // does not find all three finders
+        if (pyramid_level > 0) {
+            vector<Cluster> res = detect_patterns_pyramid(pyramid_level);
+            if (res.size() >= 3 || blank) return res;
+        }
+        if (!preprocessed) do_preprocessing();
+        if (blank) return {};
+
+        vector<Cluster> res = scan_and_cluster();
+        // the global threshold fast path missed, retry with the adaptive one
+        bool missed = whole_symbol ? !is_finder_layout(res) : res.empty();
+        if (global_binary && missed) {
+            binarize_adaptive();
+            res = scan_and_cluster();
+        }
+        return res;
+    }
+
+    /*
+     * Three finders sit on the corners of a right isosceles triangle
+     *  - the corner is the cluster opposite the longest side, the two
+     *    legs from it are within 20% of each other
+     *  - the legs meet within 15 degrees of a right angle
+     *  - the finders are the same size, no cluster has under a quarter of
+     *    the points of another
+     *  - determine_orientation reads them as a symbol with modules of at
+     *    least one pixel
+     * Loose enough for tilted or mildly skewed symbols.
+     */
+    static bool is_finder_layout(const vector<Cluster>& clusters) {
+        if (clusters.size() < 3) return false;
+        auto dist2 = [&](int i, int j) {
+            double dx = clusters[i].x - clusters[j].x;
+            double dy = clusters[i].y - clusters[j].y;
+            return dx * dx + dy * dy;
+        };
+        int corner = 0;
+        for (int i = 1; i < 3; i++) {
+            if (dist2((i + 1) % 3, (i + 2) % 3) >
+                dist2((corner + 1) % 3, (corner + 2) % 3)) {
+                corner = i;
+            }
+        }
+        const Cluster& c = clusters[corner];
+        const Cluster& a = clusters[(corner + 1) % 3];
+        const Cluster& b = clusters[(corner + 2) % 3];
+        double leg_a = hypot(a.x - c.x, a.y - c.y);
+        double leg_b = hypot(b.x - c.x, b.y - c.y);
+        if (leg_a <= 0 || leg_b <= 0) return false;
+        if (min(leg_a, leg_b) < 0.8 * max(leg_a, leg_b)) return false;
+        double cos_angle =
+            ((a.x - c.x) * (b.x - c.x) + (a.y - c.y) * (b.y - c.y)) /
+            (leg_a * leg_b);
+        if (abs(cos_angle) > MAX_CORNER_COS) return false;
+
+        auto [lo, hi] = minmax({ a.count, b.count, c.count });
+        if (lo * 4 < hi) return false;
+
+        vector<Cluster> corners(clusters.begin(), clusters.begin() + 3);
+        return determine_orientation(corners).module_size >= 1.0;
+    }
+
+    vector<Cluster> scan_and_cluster() {
+        // step 1 : adaptive pass, good enough when it finds 3 clusters
+        if (options.scan == ScanMode::ADAPTIVE) {
+            vector<Cluster> res = top_clusters(scan_rows_adaptive());
+            if (res.size() >= 3) return res;
+        }
+
+        // step 2 : scan all rows horizontally, merged in row order
+        vector<int> rows(height);
+        for (int r = 0; r < height; r++) rows[r] = r;
+        vector<PointList> row_points(height);
+        vector<int> found(height, 0);
+        scan_rows(rows, row_points, found);
+
+        PointList candidate_points;
+        for (auto& points : row_points) candidate_points.append(points);
+        return top_clusters(candidate_points);
+    }
+
+    static constexpr int LAYOUT_CANDIDATES = 6;
+    static constexpr double MAX_CORNER_COS = 0.26; // cos(75 degrees)
+
+    // Cluster candidate points and return the 3 with the most points
+    vector<Cluster> top_clusters(const PointList& candidate_points) {
+        StageTimer timer(stats->cluster_ms);
+        stats->candidate_points += candidate_points.size();
+        // Step 3: cluster all candidate points
+        double cluster_tolerance = max(width, height) * 0.05; // 5% of img size
+        auto clusters = get_clusters(candidate_points, cluster_tolerance);
+        stats->clusters += clusters.size();
+
+        // Step 4: sort by count (confidence) and return top 3
+        sort(clusters.begin(), clusters.end(),
+             [](const Cluster& a, const Cluster& b) {
+                 return a.count > b.count;
+             });
+
+        vector<Cluster> res;
+        int num_patterns = min(3, (int)clusters.size());
+        for (int i = 0; i < num_patterns; i++) res.push_back(clusters[i]);
+        if (res.size() < 3 || !whole_symbol || is_finder_layout(res)) {
+            return res;
+        }
+
+        // Step 5: a false hit outranks a finder, take the triple with the
+        // most points among the top LAYOUT_CANDIDATES laid out like finders
+        int n = min(LAYOUT_CANDIDATES, (int)clusters.size());
+        int best = -1;
+        for (int i = 0; i < n; i++) {
+            for (int j = i + 1; j < n; j++) {
+                for (int k = j + 1; k < n; k++) {
+                    vector<Cluster> triple = { clusters[i], clusters[j],
+                                               clusters[k] };
+                    int total = clusters[i].count + clusters[j].count +
+                                clusters[k].count;
+                    if (total > best && is_finder_layout(triple)) {
+                        best = total;
+                        res = triple;
+                    }
+                }
+            }
+        }
+        return res;
+    }
+};
+
+// Identify which finder pattern is in which corner using distance,
+// clusters holds at least 3
+QROrientation determine_orientation(vector<Cluster>& clusters) {
+
+    sort(clusters.begin(), clusters.end(),
+         [](const Cluster& a, const Cluster& b) {
+             if (abs(a.y - b.y) < 5) return a.x < b.x; // same row, sort by x
+             return a.y < b.y;
+         });
+
+    QROrientation res;
+    // Find top-left (smallest y, and among those, smallest x)
+    if (abs(clusters[0].y - clusters[1].y) < 5) {
+        // First two have similar y (top row)
+        res.top_left = { clusters[0].x, clusters[0].y };
+        res.top_right = { clusters[1].x, clusters[1].y };
+        res.bottom_left = { clusters[2].x, clusters[2].y };
+    } else {
+        // Need to figure it out differently
+        res.top_left = { clusters[0].x, clusters[0].y };
+        res.bottom_left = { clusters[1].x, clusters[1].y };
+        res.top_right = { clusters[2].x, clusters[2].y };
+    }
+
+    double horizontal_dist = res.top_right.x - res.top_left.x;
+    double vertical_dist = res.bottom_left.y - res.top_left.y;
+
+    // QR codes have finder patterns separated by (dimension - 14) modules
+    // For version 1: 21 modules total, patterns are 7 modules apart → 21-14=7
+    // Estimate: patterns are about (dim-14) modules apart
+    float avg_dist = (horizontal_dist + vertical_dist) / 2.0;
+
+    // Guess version based on distance
+    // For version 1 (21x21): patterns ~7 modules apart
+    // For version 2 (25x25): patterns ~11 modules apart
+    int estimated_version = 1;
+    int dimension = 21;
+
+    // Try different versions to find best fit
+    for (int v = 1; v <= 10; v++) {
+        int dim = 17 + 4 * v;
+        int pattern_separation = dim - 14; // Patterns are 14 modules from edges
+        float expected_module_size = avg_dist / pattern_separation;
+
+        // Check if this makes sense (module size between 1 and 20 pixels)
+        if (expected_module_size >= 1.0 && expected_module_size <= 20.0) {
+            estimated_version = v;
+            dimension = dim;
+            break;
+        }
+    }
+    float module_size = avg_dist / (dimension - 14);
+
+    res.module_size = module_size;
+    res.version = estimated_version;
+    res.dimension = dimension;
+    return res;
+}
+
+// [SKIPPED] Stage 5: Resolve perspective of the image
+// Stage 6: Grid samplin
+vector<vector<bool>> extract_modules(QROrientation& qro, Image& img);
+
+struct FormatInfo {
+    int error_correction_lvl;
+    int mask_pattern;
+};
+
+FormatInfo read_format_info(vector<vector<bool>>& modules, int mask_pattern);
+
+// Apply BCH error correction to format bits
+int correct_format_bits(int raw_bits);
+// Apply mask pattern to modules
+void unmask_modules(vector<vector<bool>>& modules, int mask_pattern);
+// Mask formulas for patterns 0-7
+int get_mask(int row, int col, int pattern);
+
+// Read bits in the specific serpentine pattern QR uses
+vector<uint8_t> read_data_codewords(vector<vector<bool>>& modules, int version,
+                                    int error_correction_level);
+
+// Check if position is a function pattern (finder, timing, etc.)
+bool is_function_pattern(int row, int col, int version);
+
+// Decode Reed-Solomon error correction
+bool reed_solomon_decode(vector<uint8_t>& codewords, int num_data_codewords,
+                         int num_ec_codewords);
+
+// Galois Field arithmetic helpers
+uint8_t gf_mult(uint8_t a, uint8_t b);
+uint8_t gf_div(uint8_t a, uint8_t b);
+
+enum EncodingMode { NUMERIC = 1, ALPHANUMERIC = 2, BYTE = 4, KANJI = 8 };
+
+struct DecodedData {
+    string content;
+    EncodingMode mode;
+};
+
+// Main decoding function
+DecodedData decode_data(vector<uint8_t>& codewords, int version);
+
+// Mode-specific decoders
+string decode_numeric(const uint8_t* bits, int length);
+string decode_alphanumeric(const uint8_t* bits, int length);
+string decode_byte(const uint8_t* bits, int length);
+
+// Main pipeline function, fills the symbol part of res
+void decode_qr_code(Image& img, vector<Cluster> patterns,
+                    DecodeResult& res) {
+    // 1. Detect finder patterns (already done, img.detect_patterns())
+    res.finders = patterns;
+    if (!Image::is_finder_layout(patterns)) return;
+
+    // 2. Determine orientation, a symbol only with a usable module size
+    QROrientation orientation;
+    {
+        StageTimer timer(img.stats->orientation_ms);
+        orientation = determine_orientation(patterns);
+    }
+    if (orientation.module_size <= 0) return;
+    res.found = true;
+    res.orientation = orientation;
+    return;
+
+    /* //
+        // 3. Get perspective transform
+        Matrix3x3 transform =
+            get_perspective_transform(orient.top_left, orient.top_right,
+                                      orient.bottom_left, orient.dimension);
+
+        // 4. Extract module grid
+        auto modules = extract_modules(img, orient, transform);
+
+        // 5. Read format info
+        FormatInfo format = read_format_info(modules, orient.dimension);
+
+        // 6. Unmask
+        unmask_modules(modules, format.mask_pattern);
+
+        // 7. Read codewords
+        auto codewords = read_data_codewords(modules, orient.version,
+                                             format.error_correction_level);
+
+        // 8. Error correction
+        reed_solomon_decode(codewords, data_count, ec_count);
+
+        // 9. Decode final data
+        DecodedData result = decode_data(codewords, orient.version);
+
+        res.content = result.content;
+    */
+}
+
+/*
+ * Scale for the JPEG decode, 1/2^n of the full size
+ *  - picked like the pyramid level, down to 1/8 (see Image::scale_level)
+ *  - 0 for anything else than a JPEG with no alpha
+ */
+static int jpeg_scale_log2(string_view data, const Options& options) {
+    auto bytes = (const unsigned char*)data.data();
+    bool jpeg = data.size() > 2 && bytes[0] == 0xFF && bytes[1] == 0xD8;
+    if (!jpeg) return 0;
+    if (options.jpeg_scale >= 0) return min(options.jpeg_scale, 3);
+    int width, height, channels;
+    if (!stbi_info_from_memory(bytes, (int)data.size(), &width, &height,
+                               &channels)) {
+        return 0;
+    }
+    return Image::scale_level(width, height, options, 3);
+}
+
+/*
+ * State of one Decoder::decode(), options, pool and scratch belong to the
+ * Decoder. Images it loads own their stb_image buffer.
+ */
+struct DecodeJob {
+    const Options& options;
+    shared_ptr<ThreadPool> pool;
+    Scratch& scratch;
+    DecodeResult& res;
+    shared_ptr<DecodeStats> stats = make_shared<DecodeStats>();
+
+    // Decode an encoded image (PNG, JPEG, ...) held in memory, JPEGs at
+    // 1/2^jpeg_scale of their size. data is only read, never copied.
+    optional<Image> load_image(string_view data, int jpeg_scale = 0) {
+        auto bytes = (const unsigned char*)data.data();
+
+        // Bilevel PNGs go straight to the binary image
+        BitImage bilevel;
+        bool is_bilevel;
+        {
+            StageTimer timer(stats->load_ms);
+            is_bilevel = decode_bilevel_png(bytes, data.size(), bilevel);
+        }
+        if (is_bilevel) {
+            loaded(bilevel.width, bilevel.height, 0, 0);
+            return Image(move(bilevel), options, pool, stats, move(scratch));
+        }
+
+        // Reduced IDCT, luma only. jpeg_scale comes back 0 when stb could
+        // not scale the file and returned it at full size.
+        int width, height, channels;
+        int len = (int)data.size();
+        if (jpeg_scale > 0) {
+            StbPixels pixels;
+            {
+                StageTimer timer(stats->load_ms);
+                pixels.reset(stbi_load_jpeg_luma_from_memory(
+                    bytes, len, &width, &height, &jpeg_scale));
+            }
+            if (pixels) {
+                loaded(width, height, 1, jpeg_scale);
+                Options scaled = options;
+                scaled.module_size /= 1 << jpeg_scale;
+                return Image(width, height, 1, move(pixels), scaled, pool,
+                             stats, move(scratch));
+            }
+        }
+
+        // Decode straight to luma, plus alpha when the file has it so that
+        // transparent pixels still turn white (see luma.h)
+        if (!stbi_info_from_memory(bytes, len, &width, &height, &channels)) {
+            res.error = string("Failed to load image: ") +
+                        stbi_failure_reason();
+            return nullopt;
+        }
+        int luma_channels = (channels == 2 || channels == 4) ? 2 : 1;
+        StbPixels pixels;
+        {
+            StageTimer timer(stats->load_ms);
+            pixels.reset(stbi_load_from_memory(bytes, len, &width, &height,
+                                               &channels, luma_channels));
+        }
+        if (!pixels) {
+            res.error = string("Failed to load image: ") +
+                        stbi_failure_reason();
+            return nullopt;
+        }
+        loaded(width, height, channels, 0);
+        return Image(width, height, luma_channels, move(pixels), options,
+                     pool, stats, move(scratch));
+    }
+
+    void loaded(int width, int height, int channels, int jpeg_scale) {
+        res.width = width;
+        res.height = height;
+        res.channels = channels;
+        res.jpeg_scale = jpeg_scale;
+    }
+
+    // Done with image, its buffers go back to the Decoder
+    void finish(Image& image) {
+        scratch = image.release_scratch();
+    }
+};
+
+Decoder::Decoder(Options options) : options(options) {
+    pool = make_shared<ThreadPool>(options.threads);
+}
+
+Decoder::~Decoder() = default;
+
+// Finders and orientation of a JPEG decoded at 1/2^jpeg_scale back in
+// full resolution pixels, like the pyramid: scaled pixel i covers full
+// resolution pixels [i*f, (i+1)*f)
+static void to_full_resolution(DecodeResult& res) {
+    if (res.jpeg_scale == 0) return;
+    const double f = 1 << res.jpeg_scale;
+    auto map = [&](double& x, double& y) {
+        x = (x + 0.5) * f - 0.5;
+        y = (y + 0.5) * f - 0.5;
+    };
+    for (Cluster& c : res.finders) map(c.x, c.y);
+    if (!res.found) return;
+    QROrientation& orient = res.orientation;
+    map(orient.top_left.x, orient.top_left.y);
+    map(orient.top_right.x, orient.top_right.y);
+    map(orient.bottom_left.x, orient.bottom_left.y);
+    orient.module_size *= f;
+}
+
+static double elapsed_ms(chrono::high_resolution_clock::time_point start) {
+    auto end = chrono::high_resolution_clock::now();
+    return chrono::duration<double, milli>(end - start).count();
+}
+
+// Decode the encoded image in data (file or HTTP response), find its
+// finder patterns and read the symbol
+DecodeResult Decoder::decode(string_view data) {
+    lock_guard<mutex> lock(mtx);
+    auto start_time = chrono::high_resolution_clock::now();
+    DecodeResult res;
+    DecodeJob job{ options, pool, scratch, res };
+
+    // Large JPEGs decode scaled down first, full size if that misses. A
+    // file stb could not scale is already at full size (res.jpeg_scale 0).
+    int jpeg_scale = jpeg_scale_log2(data, options);
+    optional<Image> image;
+    vector<Cluster> clusters;
+    if (jpeg_scale > 0) {
+        image = job.load_image(data, jpeg_scale);
+        if (image) clusters = image->detect_patterns();
+        bool scaled = image && res.jpeg_scale > 0;
+        if (scaled && !Image::is_finder_layout(clusters)) {
+            job.finish(*image);
+            image.reset();
+        }
+    }
+    if (!image) {
+        res.error.clear();
+        image = job.load_image(data);
+        if (!image) {
+            res.stats = *job.stats;
+            return res;
+        }
+        clusters = image->detect_patterns();
+    }
+
+    decode_qr_code(*image, move(clusters), res);
+    to_full_resolution(res);
+    job.finish(*image);
+    res.stats = *job.stats;
+    res.elapsed_ms = elapsed_ms(start_time);
+    return res;
+}
+
+// Same pipeline over the caller's pixels, read in place
+DecodeResult Decoder::decode(const ImageView& view) {
+    lock_guard<mutex> lock(mtx);
+    auto start_time = chrono::high_resolution_clock::now();
+    DecodeResult res;
+    if (view.pixels == nullptr || view.width <= 0 || view.height <= 0 ||
+        view.row_stride() < (size_t)view.width * view.channels()) {
+        res.error = "Invalid image view";
+        return res;
+    }
+    res.width = view.width;
+    res.height = view.height;
+    res.channels = view.channels();
+
+    auto stats = make_shared<DecodeStats>();
+    Image image(view, options, pool, stats, move(scratch));
+    decode_qr_code(image, image.detect_patterns(), res);
+    scratch = image.release_scratch();
+    res.stats = *stats;
+    res.elapsed_ms = elapsed_ms(start_time);
+    return res;
+}
@@ -0,0 +1,206 @@
+#ifndef QR_H
+#define QR_H
+
+#include "bit_image.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class ThreadPool;
+
+// Which adaptive threshold implementation builds the binary image
+enum class Binarizer {
+    WINDOW,   // sums the full window for every pixel
+    INTEGRAL, // summed-area table, O(1) window mean per pixel
+    STREAMING, // fused luma + threshold over a ring of WINDOW_SIZE rows
+};
+
+// Which rows detect_patterns scans for finder patterns
+enum class ScanMode {
+    FULL,     // every row
+    ADAPTIVE, // every few rows, dense around hits, FULL if that fails
+};
+
+// Decoder knobs, the CLI fills them from the command line
+struct Options {
+    Binarizer binarizer = Binarizer::INTEGRAL;
+    ScanMode scan = ScanMode::ADAPTIVE;
+    int threads = 1; // preprocessing + scan threads, 0 = one per core
+    int pyramid_level = -1;  // detect at 1/2^level scale, -1 = auto
+    float module_size = 0.0; // expected module size in pixels, 0 = unknown
+    bool global_threshold = true; // try one Otsu threshold first
+    int jpeg_scale = -1; // decode JPEGs at 1/2^n (0..3), -1 = auto
+};
+
+// STAGE 3 : Cluster points
+struct Cluster {
+    double x;
+    double y;
+    int count;
+};
+
+// STAGE 4 : Which finder pattern is in which corner
+struct QROrientation {
+    struct {
+        double x, y;
+    } top_left, top_right, bottom_left;
+    float module_size = 0.0;
+    int version = 0;
+    int dimension = 0;
+};
+
+/*
+ * Where one decode spent its time (ms) and what each stage produced
+ *  - every pass adds to the same fields: the pyramid's coarse level, the
+ *    finder windows and the adaptive threshold retry
+ *  - load is the file decode only (stb_image or the bilevel PNG reader)
+ *  - sampling, rs and data are the stages after orientation, they stay 0
+ *    until those are in place
+ * Each stage reads the clock twice per call, counters are summed on the
+ * calling thread except columns_extracted (one relaxed add per column).
+ */
+struct DecodeStats {
+    double load_ms = 0.0;
+    double grayscale_ms = 0.0; // luma conversion, histogram, downscale
+    double binarize_ms = 0.0;  // binary image and its transpose
+    double scan_ms = 0.0;      // row scans + vertical checks
+    double cluster_ms = 0.0;
+    double orientation_ms = 0.0;
+    double sampling_ms = 0.0;
+    double rs_ms = 0.0;
+    double data_ms = 0.0;
+
+    uint64_t rows_scanned = 0;
+    uint64_t columns_extracted = 0; // columns run-length scanned
+    uint64_t candidate_points = 0;  // verified finder centers
+    uint64_t clusters = 0;
+
+    // {"stages_ms": {...}, "counters": {...}}, indent < 0 = one line
+    std::string to_json(int indent = -1) const;
+};
+
+/*
+ * Outcome of one Decoder::decode()
+ *  - error: the image could not be loaded, nothing else is set
+ *  - found: three finder patterns laid out like a symbol, orientation is
+ *    only set then
+ *  - width/height/channels: the image as decoded, a JPEG decoded at
+ *    1/2^jpeg_scale is that size, channels is 0 for bilevel PNGs
+ *  - finders and orientation are in full resolution pixels whatever
+ *    jpeg_scale (or pyramid level) they were found at
+ */
+struct DecodeResult {
+    std::string error;
+    bool found = false;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    int jpeg_scale = 0;
+    std::vector<Cluster> finders;
+    QROrientation orientation;
+    std::string content; // payload, empty until sampling is in place
+    double elapsed_ms = 0.0;
+    DecodeStats stats;
+};
+
+// Pixel layout of an ImageView
+enum class PixelFormat {
+    GRAY,
+    GRAY_ALPHA,
+    RGB,
+    RGBA,
+    BGR,
+    BGRA,
+    NV12, // Y plane, then one interleaved UV plane
+    I420, // Y plane, then U and V planes
+};
+
+/*
+ * Pixels in the caller's memory, decoded in place without a copy
+ *  - width * height pixels, pixels points at the first
+ *  - stride: bytes from one row to the next, 0 = packed rows; padded
+ *    surfaces and regions of a larger frame (see sub) need no copy
+ *  - BGR(A) is read as is: luma is the plain average of the three
+ *    colors, so their order does not matter
+ *  - NV12 / I420: pixels and stride are the Y plane's, which is used as
+ *    the grayscale image with no conversion; chroma is never read
+ * The memory is only read and only used during decode().
+ */
+struct ImageView {
+    const unsigned char* pixels = nullptr;
+    int width = 0;
+    int height = 0;
+    PixelFormat format = PixelFormat::GRAY;
+    size_t stride = 0;
+
+    // Bytes per pixel of the plane that is read
+    int channels() const {
+        switch (format) {
+        case PixelFormat::GRAY_ALPHA: return 2;
+        case PixelFormat::RGB:
+        case PixelFormat::BGR: return 3;
+        case PixelFormat::RGBA:
+        case PixelFormat::BGRA: return 4;
+        default: return 1; // GRAY and the Y plane of NV12 / I420
+        }
+    }
+    size_t row_stride() const {
+        return stride ? stride : (size_t)width * channels();
+    }
+
+    // The w x h rectangle with its top left corner at (x, y), same memory.
+    // The rectangle must lie inside this view.
+    ImageView sub(int x, int y, int w, int h) const {
+        return { pixels + (size_t)y * row_stride() + (size_t)x * channels(),
+                 w, h, format, row_stride() };
+    }
+};
+
+// Buffers an Image borrows from its Decoder and hands back, so their
+// capacity carries over from one image to the next
+struct Scratch {
+    std::vector<unsigned char> gray;
+    BitImage binary;
+    BitImage binary_t;
+};
+
+/*
+ * Finds the QR symbol in an encoded image (PNG, JPEG, ...)
+ *  - no globals: the decode state lives in the Decoder and on the stack
+ *  - the thread pool and scratch buffers are made once and reused by
+ *    every decode()
+ *  - a Decoder runs one decode at a time, calls from other threads wait;
+ *    Decoders share nothing, so one per thread decode concurrently
+ *  - threads sizes this Decoder's own pool. The default 1 decodes on the
+ *    calling thread only, so N Decoders use N threads; a single Decoder
+ *    can set 0 (one per core) to spread each decode over every core
+ * Failures come back in DecodeResult, nothing exits or prints.
+ */
+class Decoder {
+public:
+    explicit Decoder(Options options = {});
+    ~Decoder();
+    Decoder(const Decoder&) = delete;
+    Decoder& operator=(const Decoder&) = delete;
+
+    // data is an encoded file (PNG, JPEG, ...), only read, never copied
+    DecodeResult decode(std::string_view data);
+    // Raw pixels, no file decode and no pixel copy
+    DecodeResult decode(const ImageView& view);
+
+    const Options& get_options() const {
+        return options;
+    }
+
+private:
+    Options options;
+    std::shared_ptr<ThreadPool> pool;
+    Scratch scratch;
+    std::mutex mtx;
+};
+
+#endif // !QR_H
@@ -429,6 +429,16 @@ STBIDEF stbi_uc* stbi_load_from_callbacks(stbi_io_callbacks const* clbk,
                                           void* user, int* x, int* y,
                                           int* channels_in_file,
                                           int desired_channels);
+// Gray JPEG decode at 1/2^*scale_log2 (0..3) of the full size. A reduced
+// IDCT turns each 8x8 block into a (8 >> scale)^2 one, so the IDCT and the
+// output shrink; the component planes are still allocated at full size,
+// only their top left corner is written. Files that can't be scaled
+// (RGB/CMYK coded, luma not at the highest sampling factor) come back at
+// full size with *scale_log2 set to 0, *x and *y are always the size
+// returned. NULL if the buffer is not a JPEG.
+STBIDEF stbi_uc* stbi_load_jpeg_luma_from_memory(stbi_uc const* buffer,
+                                                 int len, int* x, int* y,
+                                                 int* scale_log2);
 
 #    ifndef STBI_NO_STDIO
 STBIDEF stbi_uc* stbi_load(char const* filename, int* x, int* y,
@@ -2189,6 +2199,8 @@ typedef struct {
     int jfif;
     int app14_color_transform; // Adobe APP14 tag
     int rgb;
+    int luma_only;  // caller wants gray, chroma planes are never read
+    int scale_log2; // luma_only: Y plane is built at 1/2^scale_log2
 
     int scan_n, order[4];
     int restart_interval, todo;
@@ -3236,8 +3248,94 @@ static void stbi__jpeg_reset(stbi__jpeg* j) {
     // since we don't even allow 1<<30 pixels
 }
 
+static int stbi__jpeg_is_rgb(stbi__jpeg* z) {
+    return z->s->img_n == 3 &&
+           (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+}
+
+// in luma-only mode the chroma blocks of a YCbCr image are still entropy
+// decoded (the bitstream needs it) but never go through the IDCT
+static int stbi__jpeg_skip_idct(stbi__jpeg* z, int n) {
+    return z->luma_only && n > 0 && z->s->img_n == 3 && !stbi__jpeg_is_rgb(z);
+}
+
+// scaled decode needs Y to be the only plane read, at full sampling
+static int stbi__jpeg_can_scale(stbi__jpeg* z) {
+    int gray = z->s->img_n == 1 ||
+               (z->s->img_n == 3 && z->luma_only && !stbi__jpeg_is_rgb(z));
+    return gray && z->img_comp[0].h == z->img_h_max &&
+           z->img_comp[0].v == z->img_v_max;
+}
+
+// one pass of the reduced IDCT: an N point IDCT (N = 4 or 2) over the
+// lowest N coefficients, scaled by sqrt(N / 8) so the result is the block
+// averaged down by 8 / N. Constants are 1/sqrt(8), cos(pi/8) / 2 and
+// sin(pi/8) / 2 at stbi__f2f scale.
+static void stbi__idct_scaled_pass(int size, int s0, int s1, int s2, int s3,
+                                   int out[4]) {
+    const int c0 = 1448, c1 = 1892, c3 = 784;
+    if (size == 4) {
+        int e0 = (s0 + s2) * c0, e1 = (s0 - s2) * c0;
+        int o0 = s1 * c1 + s3 * c3, o1 = s1 * c3 - s3 * c1;
+        out[0] = e0 + o0;
+        out[1] = e1 + o1;
+        out[2] = e1 - o1;
+        out[3] = e0 - o0;
+    } else {
+        out[0] = (s0 + s1) * c0;
+        out[1] = (s0 - s1) * c0;
+    }
+}
+
+static void stbi__idct_scaled(stbi_uc* out, int out_stride, short data[64],
+                              int scale_log2) {
+    int size = 8 >> scale_log2, x, y, flat = 1;
+    int tmp[4][4] = { { 0 } }, res[4];
+    for (y = 0; y < size; ++y)
+        for (x = 0; x < size; ++x)
+            if ((x | y) && data[y * 8 + x]) flat = 0;
+
+    // only the DC term: every output is the block mean
+    if (flat) {
+        stbi_uc dc = stbi__clamp(((data[0] + 4) >> 3) + 128);
+        for (y = 0; y < size; ++y)
+            for (x = 0; x < size; ++x) out[y * out_stride + x] = dc;
+        return;
+    }
+
+    // rows, keeping 2 fractional bits, then columns
+    for (y = 0; y < size; ++y) {
+        short* row = data + y * 8;
+        stbi__idct_scaled_pass(size, row[0], row[1], row[2], row[3], res);
+        for (x = 0; x < size; ++x) tmp[y][x] = (res[x] + 512) >> 10;
+    }
+    for (x = 0; x < size; ++x) {
+        stbi__idct_scaled_pass(size, tmp[0][x], tmp[1][x], tmp[2][x],
+                               tmp[3][x], res);
+        for (y = 0; y < size; ++y)
+            out[y * out_stride + x] =
+                stbi__clamp((res[y] + (128 << 14) + (1 << 13)) >> 14);
+    }
+}
+
+// IDCT of block (bx, by) of component n into its plane
+static void stbi__jpeg_idct(stbi__jpeg* z, int n, int bx, int by,
+                            short data[64]) {
+    int stride = z->img_comp[n].w2;
+    if (stbi__jpeg_skip_idct(z, n)) return;
+    if (n == 0 && z->scale_log2) {
+        int size = 8 >> z->scale_log2;
+        stbi__idct_scaled(z->img_comp[n].data + stride * by * size + bx * size,
+                          stride, data, z->scale_log2);
+        return;
+    }
+    z->idct_block_kernel(z->img_comp[n].data + stride * by * 8 + bx * 8,
+                         stride, data);
+}
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg* z) {
     stbi__jpeg_reset(z);
+    if (z->scale_log2 && !stbi__jpeg_can_scale(z)) z->scale_log2 = 0;
     if (!z->progressive) {
         if (z->scan_n == 1) {
             int i, j;
@@ -3257,9 +3355,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg* z) {
                             z->huff_ac + ha, z->fast_ac[ha], n,
                             z->dequant[z->img_comp[n].tq]))
                         return 0;
-                    z->idct_block_kernel(z->img_comp[n].data +
-                                             z->img_comp[n].w2 * j * 8 + i * 8,
-                                         z->img_comp[n].w2, data);
+                    stbi__jpeg_idct(z, n, i, j, data);
                     // every data block is an MCU, so countdown the restart
                     // interval
                     if (--z->todo <= 0) {
@@ -3294,10 +3390,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg* z) {
                                         z->huff_ac + ha, z->fast_ac[ha], n,
                                         z->dequant[z->img_comp[n].tq]))
                                     return 0;
-                                z->idct_block_kernel(
-                                    z->img_comp[n].data +
-                                        z->img_comp[n].w2 * y2 + x2,
-                                    z->img_comp[n].w2, data);
+                                stbi__jpeg_idct(z, n, x2 / 8, y2 / 8, data);
                             }
                         }
                     }
@@ -3397,14 +3490,13 @@ static void stbi__jpeg_finish(stbi__jpeg* z) {
         for (n = 0; n < z->s->img_n; ++n) {
             int w = (z->img_comp[n].x + 7) >> 3;
             int h = (z->img_comp[n].y + 7) >> 3;
+            if (stbi__jpeg_skip_idct(z, n)) continue;
             for (j = 0; j < h; ++j) {
                 for (i = 0; i < w; ++i) {
                     short* data = z->img_comp[n].coeff +
                                   64 * (i + j * z->img_comp[n].coeff_w);
                     stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-                    z->idct_block_kernel(z->img_comp[n].data +
-                                             z->img_comp[n].w2 * j * 8 + i * 8,
-                                         z->img_comp[n].w2, data);
+                    stbi__jpeg_idct(z, n, i, j, data);
                 }
             }
         }
@@ -4259,17 +4351,26 @@ static stbi_uc* load_jpeg_image(stbi__jpeg* z, int* out_x, int* out_y,
     if (req_comp < 0 || req_comp > 4)
         return stbi__errpuc("bad req_comp", "Internal error");
 
+    // gray (+ alpha) output only reads Y, see stbi__jpeg_skip_idct
+    z->luma_only = req_comp == 1 || req_comp == 2;
+
     // load a jpeg image from whichever source, but leave in YCbCr format
     if (!stbi__decode_jpeg_image(z)) {
         stbi__cleanup_jpeg(z);
         return NULL;
     }
 
+    // a scaled decode only built the top left of the Y plane
+    if (z->scale_log2) {
+        int round = (1 << z->scale_log2) - 1;
+        z->s->img_x = (z->s->img_x + round) >> z->scale_log2;
+        z->s->img_y = (z->s->img_y + round) >> z->scale_log2;
+    }
+
     // determine actual number of components to generate
     n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
 
-    is_rgb = z->s->img_n == 3 &&
-             (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+    is_rgb = stbi__jpeg_is_rgb(z);
 
     if (z->s->img_n == 3 && n < 3 && !is_rgb)
         decode_n = 1;
@@ -4458,6 +4559,27 @@ static void* stbi__jpeg_load(stbi__context* s, int* x, int* y, int* comp,
     return result;
 }
 
+STBIDEF stbi_uc* stbi_load_jpeg_luma_from_memory(stbi_uc const* buffer,
+                                                 int len, int* x, int* y,
+                                                 int* scale_log2) {
+    stbi__context s;
+    stbi__jpeg* j;
+    stbi_uc* result;
+    int comp;
+    stbi__start_mem(&s, buffer, len);
+    if (!stbi__jpeg_test(&s)) return stbi__errpuc("not JPEG", "Not a JPEG");
+    j = (stbi__jpeg*)stbi__malloc(sizeof(stbi__jpeg));
+    if (!j) return stbi__errpuc("outofmem", "Out of memory");
+    memset(j, 0, sizeof(stbi__jpeg));
+    j->s = &s;
+    stbi__setup_jpeg(j);
+    j->scale_log2 = *scale_log2 < 0 ? 0 : *scale_log2 > 3 ? 3 : *scale_log2;
+    result = load_jpeg_image(j, x, y, &comp, 1);
+    *scale_log2 = j->scale_log2; // 0 when the file could not be scaled
+    STBI_FREE(j);
+    return result;
+}
+
 static int stbi__jpeg_test(stbi__context* s) {
     int r;
     stbi__jpeg* j = (stbi__jpeg*)stbi__malloc(sizeof(stbi__jpeg));
@@ -5134,6 +5256,19 @@ static void stbi__create_png_alpha_expand8(stbi_uc* dest, stbi_uc* src,
     }
 }
 
+// one row of RGB(A) to gray (out_n 1) or gray+alpha (out_n 2), the
+// full color row only ever exists in the filter buffer. Gray is the
+// truncated plain average, the value to_luma (luma.h) gives an ImageView
+// of the same pixels, not stb's weighted stbi__compute_y.
+static void stbi__create_png_luma8(stbi_uc* dest, stbi_uc* src,
+                                   stbi__uint32 x, int img_n, int out_n) {
+    stbi__uint32 i;
+    for (i = 0; i < x; ++i, src += img_n, dest += out_n) {
+        dest[0] = (stbi_uc)((src[0] + src[1] + src[2]) / 3);
+        if (out_n == 2) dest[1] = src[3];
+    }
+}
+
 // create the png data from post-deflated data
 static int stbi__create_png_image_raw(stbi__png* a, stbi_uc* raw,
                                       stbi__uint32 raw_len, int out_n,
@@ -5152,7 +5287,9 @@ static int stbi__create_png_image_raw(stbi__png* a, stbi_uc* raw,
     int filter_bytes = img_n * bytes;
     int width = x;
 
-    STBI_ASSERT(out_n == s->img_n || out_n == s->img_n + 1);
+    // out_n < img_n: 8 bit RGB(A) converted to luma row by row
+    STBI_ASSERT(out_n == s->img_n || out_n == s->img_n + 1 ||
+                (depth == 8 && img_n >= 3 && out_n <= 2));
     a->out = (stbi_uc*)stbi__malloc_mad3(
         x, y, output_bytes, 0); // extra bytes to write off the end into
     if (!a->out) return stbi__err("outofmem", "Out of memory");
@@ -5276,6 +5413,8 @@ static int stbi__create_png_image_raw(stbi__png* a, stbi_uc* raw,
         } else if (depth == 8) {
             if (img_n == out_n)
                 memcpy(dest, cur, x * img_n);
+            else if (out_n < img_n)
+                stbi__create_png_luma8(dest, cur, x, img_n, out_n);
             else
                 stbi__create_png_alpha_expand8(dest, cur, x, img_n);
         } else if (depth == 16) {
@@ -5447,6 +5586,30 @@ static int stbi__expand_png_palette(stbi__png* a, stbi_uc* palette, int len,
     return 1;
 }
 
+// palette indices to gray (out_n 1) or gray+alpha (out_n 2), the plain
+// average of stbi__create_png_luma8, the color image is never built
+static int stbi__expand_png_palette_luma(stbi__png* a, stbi_uc* palette,
+                                         int len, int pal_img_n, int out_n) {
+    stbi__uint32 i, pixel_count = a->s->img_x * a->s->img_y;
+    stbi_uc gray[256] = { 0 };
+    stbi_uc *p, *orig = a->out;
+
+    p = (stbi_uc*)stbi__malloc_mad2(pixel_count, out_n, 0);
+    if (p == NULL) return stbi__err("outofmem", "Out of memory");
+    for (i = 0; i < (stbi__uint32)len; ++i) {
+        stbi_uc* c = palette + i * 4;
+        gray[i] = (stbi_uc)((c[0] + c[1] + c[2]) / 3);
+    }
+    for (i = 0; i < pixel_count; ++i) {
+        p[i * out_n] = gray[orig[i]];
+        if (out_n == 2)
+            p[i * 2 + 1] = pal_img_n == 4 ? palette[orig[i] * 4 + 3] : 255;
+    }
+    STBI_FREE(a->out);
+    a->out = p;
+    return 1;
+}
+
 static int stbi__unpremultiply_on_load_global = 0;
 static int stbi__de_iphone_flag_global = 0;
 
@@ -5716,6 +5879,11 @@ static int stbi__parse_png_file(stbi__png* z, int scan, int req_comp) {
             if ((req_comp == s->img_n + 1 && req_comp != 3 && !pal_img_n) ||
                 has_trans)
                 s->img_out_n = s->img_n + 1;
+            else if ((req_comp == 1 || req_comp == 2) && s->img_n >= 3 &&
+                     z->depth == 8 && !interlace && !pal_img_n &&
+                     !is_iphone)
+                // gray wanted from 8 bit RGB(A): convert while unfiltering
+                s->img_out_n = (s->img_n == 4 && req_comp == 2) ? 2 : 1;
             else
                 s->img_out_n = s->img_n;
             if (!stbi__create_png_image(z, z->expanded, raw_len, s->img_out_n,
@@ -5737,8 +5905,14 @@ static int stbi__parse_png_file(stbi__png* z, int scan, int req_comp) {
                 s->img_n = pal_img_n; // record the actual colors we had
                 s->img_out_n = pal_img_n;
                 if (req_comp >= 3) s->img_out_n = req_comp;
-                if (!stbi__expand_png_palette(z, palette, pal_len,
-                                              s->img_out_n))
+                if (req_comp == 1 || req_comp == 2) {
+                    // gray wanted: look the palette up as gray directly
+                    s->img_out_n = (pal_img_n == 4 && req_comp == 2) ? 2 : 1;
+                    if (!stbi__expand_png_palette_luma(
+                            z, palette, pal_len, pal_img_n, s->img_out_n))
+                        return 0;
+                } else if (!stbi__expand_png_palette(z, palette, pal_len,
+                                                     s->img_out_n))
                     return 0;
             } else if (has_trans) {
                 // non-paletted image with tRNS -> source image has (constant)
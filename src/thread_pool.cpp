@@ -0,0 +1,66 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(int num_threads) {
+    if (num_threads <= 0) {
+        num_threads = (int)std::thread::hardware_concurrency();
+    }
+    for (int i = 1; i < num_threads; i++) {
+        workers.emplace_back([this] { worker_loop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for (auto& worker : workers) worker.join();
+}
+
+void ThreadPool::run_items() {
+    for (int i = next_item++; i < job_count; i = next_item++) (*job)(i);
+}
+
+void ThreadPool::worker_loop() {
+    unsigned long seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            work_ready.wait(lock,
+                            [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+        }
+        run_items();
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            busy_workers--;
+        }
+        work_done.notify_one();
+    }
+}
+
+void ThreadPool::parallel_for(int count,
+                              const std::function<void(int)>& fn) {
+    if (workers.empty() || count <= 1) {
+        for (int i = 0; i < count; i++) fn(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        job = &fn;
+        job_count = count;
+        next_item = 0;
+        busy_workers = (int)workers.size();
+        generation++;
+    }
+    work_ready.notify_all();
+
+    run_items();
+
+    std::unique_lock<std::mutex> lock(mtx);
+    work_done.wait(lock, [&] { return busy_workers == 0; });
+    job = nullptr;
+}
@@ -0,0 +1,48 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that run parallel_for jobs.
+// One job runs at a time, parallel_for must not be called from inside fn.
+class ThreadPool {
+public:
+    // num_threads counts the calling thread, 0 = one per core
+    explicit ThreadPool(int num_threads = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const {
+        return (int)workers.size() + 1;
+    }
+
+    // Calls fn(i) for every i in [0, count) on the workers and the calling
+    // thread, returns once all of them are done. Which thread runs which i
+    // is not fixed, so fn should only write to slots owned by i.
+    void parallel_for(int count, const std::function<void(int)>& fn);
+
+private:
+    void worker_loop();
+    void run_items();
+
+    std::vector<std::thread> workers;
+    std::mutex mtx;
+    std::condition_variable work_ready;
+    std::condition_variable work_done;
+
+    // current job, guarded by mtx except next_item
+    const std::function<void(int)>* job = nullptr;
+    int job_count = 0;
+    std::atomic<int> next_item = 0;
+    int busy_workers = 0;
+    unsigned long generation = 0;
+    bool stopping = false;
+};
+
+#endif // !THREAD_POOL_H
@@ -0,0 +1,216 @@
+// Decoder regression tests, run with `make test`
+#include "qr.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// A version 2 (25 x 25) symbol: finders, separators, timing patterns and
+// pseudo random data modules. true is a dark module.
+static vector<vector<bool>> make_symbol() {
+    const int dim = 25;
+    vector<vector<bool>> modules(dim, vector<bool>(dim, false));
+    vector<vector<bool>> fixed(dim, vector<bool>(dim, false));
+    auto finder = [&](int r0, int c0) {
+        for (int r = -1; r <= 7; r++) {
+            for (int c = -1; c <= 7; c++) {
+                int y = r0 + r, x = c0 + c;
+                if (y < 0 || y >= dim || x < 0 || x >= dim) continue;
+                int ring = max(abs(r - 3), abs(c - 3));
+                modules[y][x] = ring != 2 && ring != 4;
+                fixed[y][x] = true;
+            }
+        }
+    };
+    finder(0, 0);
+    finder(0, dim - 7);
+    finder(dim - 7, 0);
+    for (int i = 8; i < dim - 8; i++) {
+        modules[6][i] = modules[i][6] = i % 2 == 0;
+        fixed[6][i] = fixed[i][6] = true;
+    }
+    unsigned seed = 12345;
+    for (int y = 0; y < dim; y++) {
+        for (int x = 0; x < dim; x++) {
+            seed = seed * 1103515245 + 12345;
+            if (!fixed[y][x]) modules[y][x] = (seed >> 16) & 1;
+        }
+    }
+    return modules;
+}
+
+// The symbol at module pixels a module with a 4 module quiet zone, dark
+// and light are the given gray levels
+static vector<unsigned char> render(const vector<vector<bool>>& modules,
+                                    int module, int dark, int light,
+                                    int& size) {
+    int dim = (int)modules.size();
+    size = (dim + 8) * module;
+    vector<unsigned char> gray((size_t)size * size, (unsigned char)light);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            int r = y / module - 4, c = x / module - 4;
+            if (r < 0 || r >= dim || c < 0 || c >= dim) continue;
+            if (modules[r][c]) gray[(size_t)y * size + x] = dark;
+        }
+    }
+    return gray;
+}
+
+// Horizontal then vertical box blur of 2 * radius + 1 taps
+static void box_blur(vector<unsigned char>& gray, int size, int radius) {
+    vector<unsigned char> tmp(gray.size());
+    for (int pass = 0; pass < 2; pass++) {
+        const vector<unsigned char>& src = pass == 0 ? gray : tmp;
+        vector<unsigned char>& dst = pass == 0 ? tmp : gray;
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                int sum = 0, n = 0;
+                for (int k = -radius; k <= radius; k++) {
+                    int xx = pass == 0 ? x + k : x;
+                    int yy = pass == 0 ? y : y + k;
+                    if (xx < 0 || xx >= size || yy < 0 || yy >= size) continue;
+                    sum += src[(size_t)yy * size + xx];
+                    n++;
+                }
+                dst[(size_t)y * size + x] = (unsigned char)(sum / n);
+            }
+        }
+    }
+}
+
+// Every finder of res is within tolerance pixels of one of expected
+static bool finders_at(const DecodeResult& res,
+                       const vector<pair<double, double>>& expected,
+                       double tolerance) {
+    if (res.finders.size() != expected.size()) return false;
+    for (const Cluster& c : res.finders) {
+        bool hit = false;
+        for (auto [x, y] : expected) {
+            hit |= abs(c.x - x) <= tolerance && abs(c.y - y) <= tolerance;
+        }
+        if (!hit) return false;
+    }
+    return true;
+}
+
+// A soft, low contrast print still has a symbol in it, the blank check
+// must not reject it for having no sharp edges
+static bool test_blurred_low_contrast() {
+    const int module = 8;
+    int size;
+    vector<unsigned char> gray = render(make_symbol(), module, 60, 200, size);
+    box_blur(gray, size, 2);
+    box_blur(gray, size, 2);
+
+    Decoder decoder;
+    DecodeResult res = decoder.decode(ImageView{ gray.data(), size, size });
+    double c0 = 7.5 * module, c1 = (4 + 25 - 3.5) * module;
+    return res.found && res.stats.rows_scanned > 0 &&
+           finders_at(res, { { c0, c0 }, { c1, c0 }, { c0, c1 } }, module);
+}
+
+// A uniform image still stops before binarization
+static bool test_blank() {
+    const int size = 400;
+    vector<unsigned char> gray((size_t)size * size, 128);
+    Decoder decoder;
+    DecodeResult res = decoder.decode(ImageView{ gray.data(), size, size });
+    return !res.found && res.stats.rows_scanned == 0;
+}
+
+// A file under src/images, make test runs from the repository root
+static string read_image(const char* name) {
+    ifstream file(string("src/images/") + name, ios::binary);
+    return { istreambuf_iterator<char>(file), istreambuf_iterator<char>() };
+}
+
+// Without the global threshold, qr3.jpg has a false hit near the top left
+// finder that outranks it; the triple laid out like finders wins
+static bool test_false_hit_outranks_finder() {
+    string data = read_image("qr3.jpg");
+    for (Binarizer binarizer : { Binarizer::INTEGRAL, Binarizer::STREAMING }) {
+        Options options;
+        options.binarizer = binarizer;
+        options.global_threshold = false;
+        Decoder decoder(options);
+        DecodeResult res = decoder.decode(data);
+        if (!res.found || res.orientation.module_size <= 0) return false;
+        if (!finders_at(res, { { 78, 80 }, { 438, 80 }, { 78, 440 } }, 2)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A lone finder-shaped decoy with bigger modules (so more points) next to
+// a symbol: the decoy is not part of the picked triple
+static bool test_decoy_finder() {
+    const int module = 8;
+    int size;
+    vector<unsigned char> symbol = render(make_symbol(), module, 0, 255, size);
+    const int width = size + 160, height = size;
+    vector<unsigned char> gray((size_t)width * height, 255);
+    for (int y = 0; y < size; y++) {
+        copy_n(&symbol[(size_t)y * size], size, &gray[(size_t)y * width]);
+    }
+    // 7 x 7 finder pattern with 14 pixel modules centered at (dx, dy)
+    const int decoy = 14, dx = size + 70, dy = size / 2;
+    for (int r = 0; r < 7 * decoy; r++) {
+        for (int c = 0; c < 7 * decoy; c++) {
+            int ring = max(abs(r / decoy - 3), abs(c / decoy - 3));
+            int y = dy - 7 * decoy / 2 + r, x = dx - 7 * decoy / 2 + c;
+            if (ring != 2) gray[(size_t)y * width + x] = 0;
+        }
+    }
+
+    Decoder decoder;
+    DecodeResult res = decoder.decode(ImageView{ gray.data(), width, height });
+    double c0 = 7.5 * module, c1 = (4 + 25 - 3.5) * module;
+    return res.found &&
+           finders_at(res, { { c0, c0 }, { c1, c0 }, { c0, c1 } }, module);
+}
+
+// A JPEG decoded at reduced scale reports its finders in full resolution
+// pixels, like a full size decode
+static bool test_jpeg_scale_coordinates() {
+    string data = read_image("qr3.jpg");
+    vector<pair<double, double>> expected = { { 78, 80 },
+                                              { 438, 80 },
+                                              { 78, 440 } };
+    for (int scale : { 0, 1, 2 }) {
+        Options options;
+        options.jpeg_scale = scale;
+        Decoder decoder(options);
+        DecodeResult res = decoder.decode(data);
+        // a scaled pixel is 1 << scale full resolution pixels
+        if (res.jpeg_scale != scale || !res.found ||
+            !finders_at(res, expected, 2 << scale)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    const pair<const char*, function<bool()>> tests[] = {
+        { "blurred_low_contrast", test_blurred_low_contrast },
+        { "blank", test_blank },
+        { "false_hit_outranks_finder", test_false_hit_outranks_finder },
+        { "decoy_finder", test_decoy_finder },
+        { "jpeg_scale_coordinates", test_jpeg_scale_coordinates },
+    };
+    int failed = 0;
+    for (auto& [name, test] : tests) {
+        bool ok = test();
+        printf("%s %s\n", ok ? "PASS" : "FAIL", name);
+        failed += !ok;
+    }
+    return failed == 0 ? 0 : 1;
+}